@@ -0,0 +1,175 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Verificación del libro de códigos de los clientes : los patrones de los archivos XML
+(pc/*.xml) se codifican con la configuración de stubs/secrets.py, como en los clientes de
+la PC y el servicio de mandos, y con el nodo de Node-RED (node-red/irproxy-encode) :
+
+  urgent : las teclas de IR_URGENT_KEYS (IRCodeBook.urgent_keys()) deben existir en el libro
+           de códigos y llevar la prioridad (opción 0x08, PATTERN_OPT_PRIORITY), y las demás
+           no, con IRCodeBook.load(), LiveCodeBook y el nodo con las mismas teclas.
+  node   : el libro de códigos del nodo debe ser idéntico al de IRCodeBook.load(), i.e.
+           omitir los archivos que el microcontrolador rechazaría (e.g. Up.xml).
+
+Cada verificación se hace con el formato normal y con el compacto (versión 2). Además se
+verifican con el nodo :
+
+  rounding : los patrones de ROUNDING_PATTERNS, con duraciones que caen a la mitad entre
+             dos múltiplos de la base de tiempo, deben codificarse como en IRCodeBook.py
+             (round() de Python, al par más cercano).
+  vectors  : los vectores 'num' y 'pattern' de codec/vectors.txt con encodeNum() y
+             checkPattern(); se omiten los números que no representa un Number exacto.
+
+Sin Node.js (node) se omiten las verificaciones del nodo.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, como el de IRProxy_Bench.py; termina con error si alguna
+verificación falla.
+
+  python CodeBook_Bench.py
+"""
+
+import os
+import sys
+import json
+import shutil
+import argparse
+import subprocess
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, BENCH_DIR)
+
+from IRProxy_Bench import commit_id, report
+import IRCodeBook
+import IRCodec
+import secrets
+
+NODE_MODULE = os.path.join(REPO_DIR, 'node-red', 'irproxy-encode', 'irproxy-encode.js')
+VECTORS = os.path.join(REPO_DIR, 'codec', 'vectors.txt')
+MAX_SAFE_INTEGER = (1 << 53) - 1
+
+# (periodo, ciclo de trabajo, pulsos) con empates en el redondeo a la base de tiempo :
+ROUNDING_PATTERNS = [
+  (210, 70, [(145, 62), (145, 435)]),
+  (210, 70, [(147, 27), (147, 441)]),
+  (210, 70, [(164, 48), (164, 492)]),
+]
+
+
+def priority(code) :
+  u"""
+  Devuelve la prioridad (PATTERN_OPT_PRIORITY) del patrón 'code', 0 si no la indica.
+  """
+  numbers = IRCodec.decode_frame(code)
+  if numbers[0] != IRCodeBook.INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    return 0
+  options = numbers[2]
+  if not options & IRCodeBook.PATTERN_OPT_PRIORITY :
+    return 0
+  # Los valores de las opciones siguen al ciclo de trabajo, en el orden de sus bits :
+  lower = bin(options & (IRCodeBook.PATTERN_OPT_PRIORITY - 1)).count('1')
+  return numbers[5 + lower]
+
+
+def node_eval(expression) :
+  u"""
+  Devuelve el valor (JSON) de la expresión de JavaScript 'expression', evaluada con el
+  módulo del nodo de Node-RED como 'm', o None sin Node.js.
+  """
+  node = shutil.which('node')
+  if node is None :
+    return None
+  script = ("var m = require(%s); process.stdout.write(JSON.stringify(%s));"
+            % (json.dumps(NODE_MODULE), expression))
+  return json.loads(subprocess.check_output([node, '-e', script]))
+
+
+def node_codebook(path, compact, urgent_keys) :
+  u"""
+  Devuelve el libro de códigos del nodo de Node-RED (loadCodeBook()), o None sin Node.js.
+  """
+  return node_eval("m.loadCodeBook(%s, function (e) { process.stderr.write(e + '\\n'); }, %s, %s)"
+                   % (json.dumps(path), json.dumps(compact), json.dumps(list(urgent_keys))))
+
+
+def node_rounding() :
+  u"""
+  Devuelve si el nodo codifica ROUNDING_PATTERNS (compactos) como IRCodeBook.py, o None.
+  """
+  codes = node_eval("%s.map(function (p) { return m.encodeKey(p[0], p[1], p[2], true, false); })"
+                    % json.dumps(ROUNDING_PATTERNS))
+  if codes is None :
+    return None
+  return codes == [IRCodeBook.encode_pattern(period, duty, pulses, True)
+                   for period, duty, pulses in ROUNDING_PATTERNS]
+
+
+def node_vectors() :
+  u"""
+  Devuelve la lista de vectores 'num' y 'pattern' (codec/vectors.txt) que el nodo no
+  cumple, como (línea, obtenido), o None.
+  """
+  vectors = []
+  with open(VECTORS) as f :
+    for n, line in enumerate(f, 1) :
+      line = line.strip()
+      if not line or line.startswith('#') :
+        continue
+      kind, value, expected = line.split()
+      if kind == 'num' and int(value) <= MAX_SAFE_INTEGER :
+        vectors.append((n, 'm.encodeNum(%s)' % value, expected))
+      elif kind == 'pattern' :
+        vectors.append((n, 'm.checkPattern(%s)' % json.dumps(value), expected))
+
+  got = node_eval('[%s]' % ', '.join(expression for _, expression, _ in vectors))
+  if got is None :
+    return None
+  return [(n, g) for (n, _, expected), g in zip(vectors, got) if g != expected]
+
+
+def urgent_checks(codebook, urgent_keys) :
+  u"""
+  Devuelve si las teclas 'urgent_keys' existen en 'codebook' con prioridad y las demás no.
+  """
+  return (all(key in codebook for key in urgent_keys) and
+          all((priority(code) != 0) == (key in urgent_keys) for key, code in codebook.items()))
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Verificación del libro de códigos.')
+  parser.add_argument('--patterns', default=os.path.join(REPO_DIR, 'pc'))
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+
+  urgent_keys = IRCodeBook.urgent_keys(vars(secrets))
+  checks = {}
+  for mode, compact in (('hex', False), ('compact', True)) :
+    codebook = IRCodeBook.load(args.patterns, compact, urgent_keys)
+    live = IRCodeBook.LiveCodeBook(args.patterns, compact, urgent_keys)
+    checks['urgent_' + mode] = urgent_checks(codebook, urgent_keys)
+    checks['urgent_live_' + mode] = urgent_checks(dict(live), urgent_keys)
+
+    node = node_codebook(args.patterns, compact, urgent_keys)
+    if node is not None :
+      checks['urgent_node_' + mode] = urgent_checks(node, urgent_keys)
+      checks['node_' + mode] = (node == codebook)
+
+  result = {'commit' : commit_id(), 'urgent_keys' : list(urgent_keys)}
+  rounding = node_rounding()
+  if rounding is not None :
+    checks['rounding_node'] = rounding
+  failures = node_vectors()
+  if failures is not None :
+    checks['vectors_node'] = not failures
+    result['vector_failures'] = failures
+
+  result.update({'checks' : checks, 'ok' : all(checks.values())})
+  report(result, args.output)
+  if not all(checks.values()) :
+    sys.exit(1)
+
+
+if __name__ == '__main__' :
+  main()
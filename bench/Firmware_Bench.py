@@ -0,0 +1,120 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Verificación de funciones del microcontrolador (uC/IRProxy_uC.c) compiladas en la PC :
+el código de las funciones se extrae sin cambios del archivo fuente y se compila con el
+compilador de C del sistema (como codec/libvlq.so en pc/IRCodec.py), sobre sustitutos
+mínimos de los registros y de las tareas que invoca. A diferencia de PICModel.py, que
+reproduce el comportamiento esperado, se ejecuta el código real del firmware.
+
+  IRCodeWait() : con el generador en reposo (TMR2IE = 0, e.g. el primer patrón tras el
+                 arranque) debe terminar de inmediato, y durante una emisión debe esperar
+                 hasta que la interrupción la termine (TMR2IE = 0), atendiendo las tareas
+                 de control de tiempo y de supervisión mientras tanto.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, como el de IRProxy_Bench.py; termina con error si alguna
+verificación falla.
+
+  python Firmware_Bench.py
+"""
+
+import os
+import re
+import sys
+import ctypes
+import argparse
+import tempfile
+import subprocess
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, BENCH_DIR)
+
+from IRProxy_Bench import commit_id, report
+
+SOURCE = os.path.join(REPO_DIR, 'uC', 'IRProxy_uC.c')
+FUNCTIONS = ['IRCodeHasEnded', 'IRCodeWait']
+
+# Número máximo de iteraciones de las esperas, luego se fuerza su fin (y se reporta) :
+MAX_TICKS = 100000
+
+# Sustitutos de los registros y de las tareas : la "interrupción" termina la emisión tras
+# end_after invocaciones de Tick_task() :
+PRELUDE = r'''
+#include <stdbool.h>
+#include <stdint.h>
+
+struct { unsigned TMR2IE : 1 ; } PIE1bits ;
+int ticks, end_after, watchdog, stuck ;
+
+void Tick_task(void) {
+  if (++ticks == end_after) PIE1bits.TMR2IE = 0 ;
+  if (ticks >= %d) { stuck = 1 ; PIE1bits.TMR2IE = !PIE1bits.TMR2IE ; }
+}
+void ESP8266Watchdog_task(void) { watchdog++ ; }
+''' % MAX_TICKS
+
+DRIVER = r'''
+int has_ended(int busy) {
+  PIE1bits.TMR2IE = busy ;
+  return IRCodeHasEnded() ;
+}
+
+int wait(int busy, int n) {
+  PIE1bits.TMR2IE = busy ;
+  ticks = watchdog = stuck = 0 ;
+  end_after = n ;
+  IRCodeWait() ;
+  return stuck ? -1 : ticks ;
+}
+'''
+
+
+def extract(text, name) :
+  u"""
+  Devuelve la definición de la función 'name' del archivo fuente 'text'.
+  """
+  m = re.search(r'^\w[\w ]*\b%s\(void\) \{.*?^\}' % name, text, re.M | re.S)
+  if m is None :
+    raise ValueError('No se encontró la función %s.' % name)
+  return m.group(0)
+
+
+def build(workdir) :
+  with open(SOURCE, encoding='utf-8', errors='replace') as f :
+    text = f.read()
+  source = os.path.join(workdir, 'firmware.c')
+  with open(source, 'w') as f :
+    f.write(PRELUDE + '\n\n'.join(extract(text, name) for name in FUNCTIONS) + DRIVER)
+  library = os.path.join(workdir, 'firmware.so')
+  subprocess.check_call([os.environ.get('CC', 'cc'), '-O1', '-shared', '-fPIC', '-o',
+                         library, source])
+  return ctypes.CDLL(library)
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Verificación de funciones del firmware.')
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+
+  with tempfile.TemporaryDirectory() as workdir :
+    lib = build(workdir)
+    checks = {
+      'has_ended_idle' : lib.has_ended(0) == 1,
+      'has_ended_busy' : lib.has_ended(1) == 0,
+      # En reposo no se espera (ninguna iteración) :
+      'wait_idle' : lib.wait(0, 1) == 0,
+      # Durante una emisión se espera a que la interrupción la termine :
+      'wait_busy' : lib.wait(1, 50) == 50,
+    }
+
+  report({'commit' : commit_id(), 'source' : SOURCE, 'checks' : checks,
+          'ok' : all(checks.values())}, args.output)
+  if not all(checks.values()) :
+    sys.exit(1)
+
+
+if __name__ == '__main__' :
+  main()
@@ -0,0 +1,154 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Validación de la forma de onda emitida por el microcontrolador con un receptor modelado :
+
+  código (pc/*.xml) --> PICModel.emit() (CCP1/TMR2, latencia de la interrupción)
+         --> IRReceiver.Receiver (demodulador tipo TSOP) --> IRReceiver.decode()
+
+Para cada tecla del libro de códigos se reporta si se decodifica, el protocolo (NEC,
+Samsung o la comparación con las duraciones del archivo XML), el margen mínimo de sus
+duraciones y el alargamiento medio de las marcas en la salida del receptor. Con '--nec' y
+'--samsung' se agregan tramas sintéticas de esos protocolos (con la dirección y el comando
+indicados, en hexadecimal), aunque no quepan en los 46 bytes del microcontrolador
+(se indica en 'pic_check').
+
+Permite evaluar optimizaciones del generador antes de probarlas en el equipo :
+  --compact           : patrones con base de tiempo (versión 2).
+  --carrier-step N    : periodo y periodo activo de la portadora redondeados a N ciclos.
+  --latency, --jitter : latencia de la interrupción y su variación (uSeg.).
+  --level             : nivel de la señal (múltiplos del umbral), i.e. la distancia.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, como el de IRProxy_Bench.py; termina con error si alguna
+tecla no se decodifica.
+
+  python IRDecode_Bench.py --compact --jitter 4
+"""
+
+import os
+import sys
+import random
+import argparse
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, BENCH_DIR)
+sys.path.insert(1, os.path.join(REPO_DIR, 'pc'))
+
+import IRCodec
+import IRCodeBook
+import IRReceiver
+import PICModel
+from IRProxy_Bench import commit_id, report
+
+# Portadora de las tramas sintéticas (38 kHz, 1/3) :
+SYNTHETIC_PERIOD = 842
+SYNTHETIC_DUTY = 281
+
+
+def synthetic(name, bits) :
+  u"""
+  Devuelve (periodo, periodo activo, pulsos) de la trama 'bits' del protocolo 'name'.
+  """
+  d = IRReceiver.pulse_distance(name, bits)
+  cycles = [max(1, int(round(us * PICModel.FOSC / 1e6 / SYNTHETIC_PERIOD))) for us in d]
+  return SYNTHETIC_PERIOD, SYNTHETIC_DUTY, list(zip(cycles[0::2], cycles[1::2]))
+
+
+def quantize_carrier(period, duty, step) :
+  u"""
+  Devuelve la portadora redondeada a múltiplos de 'step' ciclos (conserva la duración
+  de los pulsos, expresada en periodos de la portadora, por lo que cambia levemente).
+  """
+  if step <= 1 :
+    return period, duty
+  return max(step, int(round(float(period) / step)) * step), max(step, int(round(float(duty) / step)) * step)
+
+
+def validate(key, period, duty, pulses, args, rng) :
+  code = IRCodeBook.encode_pattern(*quantize_carrier(period, duty, args.carrier_step),
+                                   pulses=pulses, compact=args.compact)
+  on, carrier_period = PICModel.emit(bytes.fromhex(code), args.latency * 1e-6,
+                                     args.jitter * 1e-6, rng)
+  receiver = IRReceiver.Receiver(IRReceiver.receiver_carrier(PICModel.FOSC / period),
+                                 level=args.level)
+  d = IRReceiver.durations(receiver.demodulate(on))
+
+  # Duraciones del patrón original (uSeg.), sin el espacio final :
+  reference = [1e6 * n * period / PICModel.FOSC for pulse in pulses for n in pulse][:-1]
+  result = IRReceiver.decode(d, reference)
+  marks = [m - r for m, r in zip(d[0::2], reference[0::2])]
+  result.update({
+    'key' : key,
+    'code_bytes' : len(code) // 2,
+    'pic_check' : IRCodec.ERRORS.get(IRCodec.check_pattern(code), 'ok'),
+    'carrier_hz' : round(1.0 / carrier_period) if carrier_period else None,
+    'receiver_hz' : receiver.f0,
+    'edges' : len(d),
+    'mark_excess_us' : round(sum(marks) / len(marks), 1) if marks else None,
+  })
+  if result['margin'] is not None :
+    result['margin'] = round(result['margin'], 3)
+  if result['bits'] is not None :
+    result['bits'] = '%08X' % result['bits']
+  return result
+
+
+def nec_bits(address, command) :
+  return address | ((~address & 0xFF) << 8) | (command << 16) | ((~command & 0xFF) << 24)
+
+
+def samsung_bits(address, command) :
+  return address | (address << 8) | (command << 16) | ((~command & 0xFF) << 24)
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Validación de la emisión con un receptor modelado.')
+  parser.add_argument('--patterns', default=os.path.join(REPO_DIR, 'pc'))
+  parser.add_argument('--compact', action='store_true', help='Patrones con base de tiempo (v2).')
+  parser.add_argument('--carrier-step', type=int, default=1, help='Cuantificación de la portadora (ciclos).')
+  parser.add_argument('--latency', type=float, default=1e6 * PICModel.ISR_LATENCY,
+                      help='Latencia de la interrupción (uSeg.).')
+  parser.add_argument('--jitter', type=float, default=0.0, help='Variación de la latencia (uSeg.).')
+  parser.add_argument('--level', type=float, default=IRReceiver.LEVEL, help='Nivel de la señal.')
+  parser.add_argument('--nec', default=None, metavar='AACC', help='Trama NEC sintética.')
+  parser.add_argument('--samsung', default=None, metavar='AACC', help='Trama Samsung sintética.')
+  parser.add_argument('--seed', type=int, default=1)
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+  rng = random.Random(args.seed)
+
+  keys = []
+  for f in sorted(IRCodeBook.glob.glob(os.path.join(args.patterns, '*.xml'))) :
+    period, duty, pulses = IRCodeBook.read_pattern(f)
+    code = IRCodeBook.encode_pattern(period, duty, pulses)
+    if IRCodec.check_pattern(code) == IRCodec.OK :
+      keys.append((IRCodeBook.key_id(f), period, duty, pulses))
+  for name, bits in (('nec', nec_bits), ('samsung', samsung_bits)) :
+    value = getattr(args, name)
+    if value :
+      keys.append((name.upper(),) + synthetic(name, bits(int(value[:2], 16), int(value[2:], 16))))
+
+  results = [validate(key, period, duty, pulses, args, rng) for key, period, duty, pulses in keys]
+  margins = [r['margin'] for r in results if r['margin'] is not None]
+  report({
+    'commit' : commit_id(),
+    'compact' : args.compact,
+    'carrier_step' : args.carrier_step,
+    'latency_us' : args.latency,
+    'jitter_us' : args.jitter,
+    'level' : args.level,
+    'keys' : len(results),
+    'decoded' : sum(r['ok'] for r in results),
+    'min_margin' : min(margins) if margins else None,
+    'results' : results,
+  }, args.output)
+
+  if not all(r['ok'] for r in results) :
+    sys.exit(1)
+
+
+if __name__ == '__main__' :
+  main()
@@ -0,0 +1,455 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Banco de pruebas de la cadena completa en una sola PC :
+
+  generador --MQTT--> broker local --MQTT--> relay_code() (esp8266/IRProxy_uPy.py)
+            --SPI simulado--> modelo del microcontrolador (PICModel.py)
+
+El módulo del ESP8266 se ejecuta sin modificaciones, sustituyendo los módulos propios de
+MicroPython por los del directorio 'stubs'. El tráfico generado es configurable :
+
+  burst : COUNT teclas diferentes, publicadas tan rápido como sea posible.
+  hold  : la misma tecla repetida cada INTERVAL seg. (tecla mantenida presionada).
+  mixed : teclas al azar, con intervalos exponenciales de media 1/RATE seg.
+
+Con '--transport udp' los mensajes se envían directamente al socket UDP del módulo ESP8266
+(pc/IRProxyUDP.py), sin pasar por el broker.
+
+Con '--learn KEY' se verifica el modo de aprendizaje : se solicita el aprendizaje con la
+portadora de la tecla KEY, el modelo del microcontrolador recibe la forma de onda sintética
+del patrón de esa tecla (con un error aleatorio de desviación JITTER uSeg. en cada flanco)
+y se compara el patrón publicado por el módulo con el original.
+
+Con '--compact' los patrones se codifican con la versión 2 del protocolo (base de tiempo)
+cuando resulta más corta.
+
+Con '--zone NAME' (repetible) los mensajes se publican, en forma alternada, en los tópicos
+de las zonas (TOPIC/zone/NAME, definidas en stubs/secrets.py) y se verifica que el modelo
+del microcontrolador emita cada patrón por las salidas de su zona.
+
+Con '--group NAME' los mensajes se publican en el tópico del grupo (IRCodeBook.group_topic())
+en lugar del tópico del equipo, y con '--foreign' cada mensaje se publica además en el
+tópico de otro equipo del sitio, que el módulo ESP8266 no debe recibir. El estado publicado
+por el módulo (TOPIC/status) y el último estado de salud (TOPIC/health) se incluyen en el
+resultado.
+
+Con '--at SEG' cada mensaje se programa (IRCodeBook.at()) para emitirse SEG seg. después de
+su publicación, el módulo ESP8266 sincroniza su reloj con el servidor SNTP local (desfasado
+'--clock-offset' seg.) y se reporta el error entre el inicio de cada emisión en el modelo
+del microcontrolador y el instante programado. Con '--at-every N' solo se programa cada
+N-ésimo mensaje, la tecla '--at-key' (que no se usa en los demás), de manera que los
+mensajes programados llegan tras los pendientes del carril normal (e.g. '--profile burst').
+
+Con '--trace' al terminar se solicita el registro de eventos del microcontrolador, que se
+interpreta con pc/IRTrace.py y se resume por tipo de evento.
+
+Con '--urgent N' cada N-ésimo mensaje es la tecla '--urgent-key' con prioridad
+(IRCodeBook.urgent()), y se reporta por separado su latencia (latency_ms.urgent), que debe
+mantenerse acotada aunque la tecla repetida (hold) o la ráfaga (burst) ocupen al
+microcontrolador.
+
+Con '--decode' cada patrón emitido por el modelo del microcontrolador (con las opciones
+agregadas por el módulo ESP8266) se emite con PICModel.emit() y se decodifica con el
+receptor modelado (IRReceiver.py, ver IRDecode_Bench.py).
+
+Con '--ttl MS' cada mensaje lleva su instante de envío y vigencia, '--stale SEG' lo
+antedata para simular las pulsaciones acumuladas durante una desconexión, que el módulo
+debe descartar.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, para poder comparar los resultados entre versiones.
+
+  python IRProxy_Bench.py --profile hold --count 50 --interval 0.11
+"""
+
+import os
+import sys
+import gc
+import json
+import time
+import random
+import argparse
+import threading
+import subprocess
+import collections
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, os.path.join(BENCH_DIR, 'stubs'))
+sys.path.insert(0, BENCH_DIR)
+sys.path.insert(1, os.path.join(REPO_DIR, 'esp8266'))
+sys.path.insert(1, os.path.join(REPO_DIR, 'pc'))
+
+import machine
+import MQTTStandIn
+import PICModel
+import IRCodeBook
+import IRProxyUDP
+import IRTrace
+import IRReceiver
+import secrets
+
+# Tópicos del equipo (configurado en stubs/secrets.py) y de otro equipo del mismo sitio :
+TOPIC = IRCodeBook.device_topic(vars(secrets))
+CMD_TOPIC = IRCodeBook.command_topic(TOPIC)
+FOREIGN_TOPIC = IRCodeBook.command_topic(IRCodeBook.device_topic(vars(secrets), 'otro/tv'))
+
+# Tiempo máximo de espera del patrón aprendido (seg.) :
+LEARN_WAIT = 15.0
+
+# Al terminar la generación, se espera hasta que el microcontrolador no reciba mensajes
+# durante DRAIN_TIME seg. para que los mensajes en curso concluyan :
+DRAIN_TIME = 1.0
+
+
+def percentiles(samples) :
+  if not samples :
+    return None
+  s = sorted(samples)
+  pick = lambda p : s[min(len(s) - 1, int(round(p * (len(s) - 1))))]
+  return {'p50' : round(1e3*pick(0.50), 3), 'p90' : round(1e3*pick(0.90), 3),
+          'p99' : round(1e3*pick(0.99), 3), 'max' : round(1e3*s[-1], 3),
+          'n' : len(s)}
+
+
+def traffic(profile, codebook, count, interval, rate, key) :
+  u"""
+  Devuelve la secuencia de (espera previa, tecla) del perfil solicitado.
+  """
+  keys = sorted(k for k in codebook)
+  if profile == 'burst' :
+    return [(0.0, keys[i % len(keys)]) for i in range(count)]
+  if profile == 'hold' :
+    return [(interval if i else 0.0, key) for i in range(count)]
+  return [(random.expovariate(rate) if i else 0.0, random.choice(keys)) for i in range(count)]
+
+
+def pattern_key(frame) :
+  u"""
+  Devuelve la portadora y los pulsos del patrón 'frame', sin sus opciones (salidas, demora,
+  ...), para identificar su tecla en las emisiones del modelo del microcontrolador.
+  """
+  kind, idx = PICModel.read_number(frame, 0, 1)
+  p, idx = PICModel.read_pattern(frame, idx, kind)
+  return p['period'], p['duty'], p['base'], tuple(p['pulses'])
+
+
+def learn(args, codebook, pic, broker) :
+  u"""
+  Verifica el aprendizaje de la tecla args.learn, devuelve el resultado.
+  """
+  period, duty, pulses = IRCodeBook.decode(codebook[args.learn])
+  us = lambda cycles : cycles * period * 1e6 / PICModel.FOSC
+  pic.waveform = [(max(1.0, random.gauss(us(h), args.jitter)),
+                   max(1.0, random.gauss(us(l), args.jitter))) for h, l in pulses]
+
+  learned = []
+  listener = MQTTStandIn.MQTTClient('IRProxy_Bench_learn', '127.0.0.1', broker.port)
+  listener.set_callback(lambda topic, msg : learned.append((time.monotonic(), msg.decode())))
+  listener.connect()
+  listener.subscribe(TOPIC + IRCodeBook.LEARNED_SUBTOPIC)
+  threading.Thread(target=lambda : [listener.wait_msg() for _ in iter(int, 1)],
+                   daemon=True).start()
+
+  publisher = MQTTStandIn.MQTTClient('IRProxy_Bench', '127.0.0.1', broker.port)
+  publisher.connect()
+  start = time.monotonic()
+  publisher.publish(CMD_TOPIC, IRCodeBook.encode_learn(period, duty))
+  while not learned and time.monotonic() - start < LEARN_WAIT :
+    time.sleep(0.01)
+
+  result = {'commit' : commit_id(), 'learn' : args.learn, 'jitter_us' : args.jitter,
+            'pulses' : len(pulses), 'learned' : None}
+  if not learned :
+    return result
+
+  t, code = learned[0]
+  l_period, l_duty, l_pulses = IRCodeBook.decode(code)
+  # El último reposo es el fin de la captura (LEARN_END_GAP), no se compara :
+  original = [n for p in pulses for n in p][:2*len(l_pulses)-1]
+  errors = [a - b for a, b in zip([n for p in l_pulses for n in p], original)]
+  try :
+    PICModel.parse(bytes.fromhex(code))
+    replayable = True
+  except PICModel.FrameError :
+    replayable = False
+
+  result.update({
+    'learned' : len(l_pulses),
+    'carrier_ok' : (l_period, l_duty) == (period, duty),
+    'replayable' : replayable,
+    'max_error_cycles' : max(abs(e) for e in errors) if errors else None,
+    'mean_abs_error_cycles' : round(sum(abs(e) for e in errors) / len(errors), 3) if errors else None,
+    'capture_to_publish_ms' : round(1e3 * (t - pic.learned_at), 3),
+    'request_to_publish_s' : round(t - start, 3),
+  })
+  return result
+
+
+def commit_id() :
+  try :
+    return subprocess.check_output(['git', 'describe', '--always', '--dirty'], cwd=REPO_DIR,
+                                   stderr=subprocess.DEVNULL).decode().strip()
+  except Exception :
+    return None
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Banco de pruebas de IRProxy.')
+  parser.add_argument('--profile', choices=('burst', 'hold', 'mixed'), default='mixed')
+  parser.add_argument('--count', type=int, default=50, help='Número de mensajes.')
+  parser.add_argument('--interval', type=float, default=0.11, help='Periodo de repetición (hold).')
+  parser.add_argument('--rate', type=float, default=5.0, help='Mensajes por segundo (mixed).')
+  parser.add_argument('--key', default='Vol-Plus', help='Tecla repetida (hold).')
+  parser.add_argument('--transport', choices=('mqtt', 'udp'), default='mqtt')
+  parser.add_argument('--patterns', default=os.path.join(REPO_DIR, 'pc'))
+  parser.add_argument('--seed', type=int, default=1)
+  parser.add_argument('--learn', default=None, metavar='KEY', help='Verifica el aprendizaje de KEY.')
+  parser.add_argument('--jitter', type=float, default=20.0, help='Error de los flancos (uSeg., learn).')
+  parser.add_argument('--compact', action='store_true', help='Patrones con base de tiempo (v2).')
+  parser.add_argument('--zone', action='append', default=[], help='Zona de destino (mqtt).')
+  parser.add_argument('--group', default=None, help='Grupo de destino (mqtt).')
+  parser.add_argument('--foreign', action='store_true', help='Publica también a otro equipo.')
+  parser.add_argument('--at', type=float, default=0.0, help='Emisión programada (seg.).')
+  parser.add_argument('--at-every', type=int, default=1, metavar='N', help='Cada N-ésimo mensaje es programado.')
+  parser.add_argument('--at-key', default='Audio', help='Tecla programada (--at-every).')
+  parser.add_argument('--clock-offset', type=float, default=0.0, help='Desfase del SNTP (seg.).')
+  parser.add_argument('--trace', action='store_true', help='Lee el registro de eventos al final.')
+  parser.add_argument('--urgent', type=int, default=0, metavar='N', help='Cada N-ésimo mensaje es urgente.')
+  parser.add_argument('--urgent-key', default='Audio', help='Tecla urgente (e.g. MUTE).')
+  parser.add_argument('--decode', action='store_true', help='Decodifica los patrones emitidos.')
+  parser.add_argument('--ttl', type=int, default=0, help='Vigencia de los mensajes (mseg.).')
+  parser.add_argument('--stale', type=float, default=0.0, help='Antigüedad de los mensajes (seg.).')
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  parser.add_argument('--verbose', action='store_true', help='Muestra los mensajes del ESP8266.')
+  args = parser.parse_args()
+  random.seed(args.seed)
+
+  codebook = IRCodeBook.load(args.patterns, args.compact)
+
+  # Broker local en un puerto libre, el ESP8266 lo utiliza por omisión :
+  broker = MQTTStandIn.Broker(port=0).start()
+  MQTTStandIn.DEFAULT_PORT = broker.port
+
+  # Servidor de tiempo del ESP8266 :
+  time_server = MQTTStandIn.TimeServer(offset=args.clock_offset).start()
+  secrets.NTP_HOST, secrets.NTP_PORT = '127.0.0.1', time_server.port
+
+  # Modelo del microcontrolador en el extremo del SPI :
+  pic = PICModel.PICModel()
+  machine.SPI.sink = pic.receive
+  machine.SPI.source = pic.read
+
+  # Módulo del ESP8266, la memoria ocupada del 'gc' de MicroPython se aproxima con los
+  # bloques asignados por el intérprete (la libre no tiene equivalente) :
+  gc.mem_alloc = sys.getallocatedblocks
+  gc.mem_free = lambda : 0
+  import IRProxy_uPy
+  if not args.verbose :
+    IRProxy_uPy.print = lambda *a, **k : None
+  threading.Thread(target=IRProxy_uPy.task, daemon=True).start()
+
+  # Espera que el ESP8266 se suscriba y publique su estado :
+  while IRProxy_uPy.mqtt_client is None or IRProxy_uPy.udp_sock is None :
+    time.sleep(0.01)
+
+  if args.learn :
+    report(learn(args, codebook, pic, broker), args.output)
+    return
+
+  # Generación del tráfico, se registra el instante de publicación de cada mensaje :
+  if args.transport == 'udp' :
+    link = IRProxyUDP.UDPLink('127.0.0.1', IRProxy_uPy.udp_sock.getsockname()[1],
+                              IRProxy_uPy.udp_key, timeout=1.0)
+    publish = lambda payload : link.send(payload)
+  else :
+    publisher = MQTTStandIn.MQTTClient('IRProxy_Bench', '127.0.0.1', broker.port)
+    publisher.connect()
+    default_topic = IRCodeBook.group_topic(args.group, vars(secrets)) if args.group else CMD_TOPIC
+    status, health = [], []
+    health_topic = (TOPIC + IRCodeBook.HEALTH_SUBTOPIC).encode()
+    publisher.set_callback(lambda topic, msg : (health if topic == health_topic else status).append(msg.decode()))
+    publisher.subscribe(TOPIC + IRCodeBook.STATUS_SUBTOPIC)
+    publisher.subscribe(TOPIC + IRCodeBook.HEALTH_SUBTOPIC)
+    def publish(payload, zone=None) :
+      if args.foreign :
+        publisher.publish(FOREIGN_TOPIC, payload)
+      publisher.publish(IRCodeBook.zone_topic(TOPIC, zone) if zone else default_topic, payload)
+  if args.ttl :
+    transport = publish
+    publish = lambda payload, *zone : transport(IRCodeBook.stamp(payload, args.ttl, time.time() - args.stale), *zone)
+  sent = collections.defaultdict(collections.deque)
+  urgent = set()
+  order, targets = collections.deque(), []
+  traffic_keys = codebook
+  if args.at and args.at_every > 1 :
+    traffic_keys = {k : c for k, c in codebook.items() if k != args.at_key}
+  schedule = traffic(args.profile, traffic_keys, args.count, args.interval, args.rate, args.key)
+  start = time.monotonic()
+  next_at = start
+  expected = [0] * PICModel.IR_OUTPUTS
+  for n, (delay, key) in enumerate(schedule) :
+    next_at += delay
+    time.sleep(max(0.0, next_at - time.monotonic()))
+    payload = codebook[key]
+    if args.urgent and n % args.urgent == args.urgent - 1 :
+      payload = IRCodeBook.urgent(codebook[args.urgent_key])
+    order.append(time.monotonic())
+    message = payload
+    if args.at and args.at_every > 1 :
+      if n % args.at_every == args.at_every - 1 :
+        payload = message = codebook[args.at_key]
+        targets.append(time.monotonic() + args.at)
+        message = IRCodeBook.at(payload, time.time() + args.at)
+    elif args.at :
+      targets.append(time.monotonic() + args.at)
+      message = IRCodeBook.at(payload, time.time() + args.at)
+    if args.zone :
+      # El patrón llega al microcontrolador con las salidas de la zona :
+      zone = args.zone[n % len(args.zone)]
+      outputs = IRProxy_uPy.zones[zone]
+      frame = bytes(IRProxy_uPy.route(bytes.fromhex(payload), outputs))
+      if IRProxy_uPy.pattern_priority(frame) :
+        urgent.add(frame.hex().upper().encode())
+      sent[frame.hex().upper().encode()].append(time.monotonic())
+      publish(message, zone)
+    else :
+      outputs = PICModel.DEFAULT_OUTPUTS
+      if IRProxy_uPy.pattern_priority(bytes.fromhex(payload)) :
+        urgent.add(payload.encode())
+      sent[payload.encode()].append(time.monotonic())
+      publish(message)
+    for i in range(PICModel.IR_OUTPUTS) :
+      expected[i] += (outputs >> i) & 1
+  end = time.monotonic()
+  while True :
+    time.sleep(DRAIN_TIME)
+    with pic.lock :
+      if not pic.events or (time.monotonic() - pic.events[-1][0]) >= DRAIN_TIME :
+        break
+
+  # Asocia cada mensaje recibido por el microcontrolador con su publicación :
+  to_spi, to_ir, urgent_to_ir = [], [], []
+  last = end
+  for t, frame, result, ir_end in list(pic.events) :
+    last = max(last, ir_end or t)
+    if args.at :
+      # Los patrones programados llegan con la demora, se asocian en orden :
+      if result != 'transmitted' or not order :
+        continue
+      published = order.popleft()
+    else :
+      pending = sent.get(frame.hex().upper().encode())
+      if not pending :
+        continue
+      published = pending.popleft()
+    to_spi.append(t - published)
+    if ir_end is not None :
+      to_ir.append(ir_end - published)
+      if frame.hex().upper().encode() in urgent :
+        urgent_to_ir.append(ir_end - published)
+
+  transmitted = pic.counters['transmitted']
+  result = {
+    'commit' : commit_id(),
+    'profile' : args.profile,
+    'transport' : args.transport,
+    'compact' : args.compact,
+    'code_bytes' : sum(len(c) // 2 for c in codebook.values()),
+    'sent' : len(schedule),
+    'relayed' : len(to_spi),
+    'transmitted' : transmitted,
+    'pic' : dict(pic.counters),
+    'relay' : dict(IRProxy_uPy.stats),
+    'routing_ok' : pic.counters['outputs'] == expected,
+    'drop_rate' : round(1.0 - float(transmitted) / len(schedule), 4),
+    'offered_rate' : round(len(schedule) / max(end - start, 1e-9), 2),
+    'throughput' : round(transmitted / max(last - start, 1e-9), 2),
+    'latency_ms' : {'publish_to_spi' : percentiles(to_spi),
+                    'publish_to_ir_end' : percentiles(to_ir)},
+  }
+
+  if args.transport == 'mqtt' :
+    # Los mensajes publicados por el módulo durante la prueba :
+    while publisher.check_msg() is not None :
+      pass
+    result['status'] = status[-1] if status else None
+    result['health'] = json.loads(health[-1]) if health else None
+
+  if args.urgent :
+    result['latency_ms']['urgent_to_ir_end'] = percentiles(urgent_to_ir)
+
+  if args.at :
+    starts = pic.starts
+    if args.at_every > 1 :
+      # Las emisiones de la tecla programada, la única con ese patrón :
+      key = pattern_key(bytes.fromhex(codebook[args.at_key]))
+      starts = [s for s, f in zip(pic.starts, pic.start_frames) if pattern_key(f) == key]
+    errors = [abs(start - target) for start, target in zip(starts, targets)]
+    result['at_error_ms'] = percentiles(errors)
+
+  if args.trace :
+    result['trace'] = read_trace(broker)
+
+  if args.decode :
+    result['decode'] = decode_events(pic)
+
+  report(result, args.output)
+
+
+def decode_events(pic) :
+  u"""
+  Devuelve el resumen de la decodificación, con el receptor modelado, de los patrones
+  emitidos por el modelo del microcontrolador.
+  """
+  decoded, margins, frames = 0, [], [f for t, f, result, end in pic.events if result == 'transmitted']
+  for frame in frames :
+    period, duty, pulses = IRCodeBook.decode(frame.hex())
+    on, carrier_period = PICModel.emit(frame)
+    receiver = IRReceiver.Receiver(IRReceiver.receiver_carrier(PICModel.FOSC / period))
+    reference = [1e6 * n * period / PICModel.FOSC for pulse in pulses for n in pulse][:-1]
+    r = IRReceiver.decode(IRReceiver.durations(receiver.demodulate(on)), reference)
+    decoded += r['ok']
+    if r['margin'] is not None :
+      margins.append(r['margin'])
+  return {'frames' : len(frames), 'decoded' : decoded,
+          'min_margin' : round(min(margins), 3) if margins else None}
+
+
+def read_trace(broker) :
+  u"""
+  Solicita el registro de eventos y devuelve el número de eventos de cada tipo, o None.
+  """
+  traces = []
+  listener = MQTTStandIn.MQTTClient('IRProxy_Bench_trace', '127.0.0.1', broker.port)
+  listener.set_callback(lambda topic, msg : traces.append(msg.decode()))
+  listener.connect()
+  listener.subscribe(TOPIC + IRCodeBook.TRACE_SUBTOPIC)
+  threading.Thread(target=lambda : [listener.wait_msg() for _ in iter(int, 1)],
+                   daemon=True).start()
+
+  publisher = MQTTStandIn.MQTTClient('IRProxy_Bench_trace_req', '127.0.0.1', broker.port)
+  publisher.connect()
+  publisher.publish(CMD_TOPIC, IRCodeBook.encode_trace())
+  deadline = time.monotonic() + LEARN_WAIT
+  while not traces and time.monotonic() < deadline :
+    time.sleep(0.01)
+  if not traces :
+    return None
+
+  summary = collections.Counter(e['event'] for e in IRTrace.decode(traces[0]))
+  return dict(summary)
+
+
+def report(result, output) :
+  line = json.dumps(result, sort_keys=True)
+  print(line)
+  if output :
+    with open(output, 'a') as f :
+      f.write(line + '\n')
+
+
+if __name__ == '__main__' :
+  main()
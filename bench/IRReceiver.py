@@ -0,0 +1,213 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Modelo de un receptor infrarrojo demodulador (tipo TSOP) y de los decodificadores de los
+protocolos, para validar la forma de onda emitida por el microcontrolador
+(PICModel.emit()) sin un osciloscopio :
+
+  1. Receiver.demodulate() : la señal del LED (intervalos de emisión) se muestrea a
+     SAMPLES_PER_CYCLE muestras por ciclo de la frecuencia central f0 y se filtra con un
+     resonador de factor de calidad Q (filtro pasa-banda), cuya envolvente se compara con el
+     umbral (con histéresis). La salida se activa tras MIN_BURST ciclos sobre el umbral
+     (longitud mínima de las ráfagas y demora de la envolvente) y se libera tras RELEASE
+     ciclos bajo el umbral. El control automático de ganancia (AGC) reduce la ganancia
+     cuando la fracción de tiempo activa (media de constante AGC_TAU) excede AGC_LIMIT,
+     como ante una portadora continua.
+  2. decode() : las duraciones de la salida (marcas y espacios, uSeg.) se interpretan con
+     los protocolos de distancia de pulsos NEC y Samsung (PROTOCOLS), o se comparan con las
+     del patrón de referencia (match()) para los protocolos sin decodificador.
+
+Cada duración se acepta dentro de la ventana nominal +/- (TOLERANCE * nominal + TICK_US),
+la de los decodificadores habituales (e.g. IRremote). El margen de una duración es la
+fracción de la semi-ventana que no utiliza : 1 sin error, 0 en el borde, negativo fuera.
+"""
+
+import cmath
+import math
+
+# Frecuencias centrales de los receptores comerciales (Hz), se elige la más cercana a la
+# portadora del patrón :
+CARRIERS = (30e3, 33e3, 36e3, 36.7e3, 38e3, 40e3, 56e3)
+
+SAMPLES_PER_CYCLE = 8
+Q = 8.0
+THRESHOLD_OFF = 0.5
+MIN_BURST = 6
+RELEASE = 2
+AGC_TAU = 20e-3
+AGC_LIMIT = 0.5
+AGC_SLOPE = 4.0
+
+# Nivel de la señal recibida, en múltiplos del umbral (portadora continua de ciclo de trabajo
+# 50 % en f0), menor cuanto mayor es la distancia :
+LEVEL = 20.0
+
+TOLERANCE = 0.25
+TICK_US = 50
+
+# Protocolos de distancia de pulsos (uSeg.) : cabecera (marca, espacio), marca de cada bit,
+# espacio del 0 y del 1, y número de bits (seguidos de la marca final) :
+PROTOCOLS = {
+  'nec' : {'header' : (9000, 4500), 'mark' : 560, 'zero' : 560, 'one' : 1690, 'bits' : 32},
+  'samsung' : {'header' : (4500, 4500), 'mark' : 560, 'zero' : 560, 'one' : 1690, 'bits' : 32},
+}
+
+
+def receiver_carrier(carrier) :
+  u"""
+  Devuelve la frecuencia central (CARRIERS) más cercana a la frecuencia 'carrier' (Hz).
+  """
+  return min(CARRIERS, key=lambda f : abs(f - carrier))
+
+
+class Receiver(object) :
+  u"""
+  Receptor demodulador de frecuencia central 'f0' (Hz), con el nivel de señal 'level'.
+  """
+
+  def __init__(self, f0, level=LEVEL, q=Q, min_burst=MIN_BURST, release=RELEASE,
+               agc_limit=AGC_LIMIT) :
+    self.f0, self.level, self.q = f0, level, q
+    self.min_burst, self.release, self.agc_limit = min_burst, release, agc_limit
+    self.dt = 1.0 / (SAMPLES_PER_CYCLE * f0)
+    self.pole = cmath.exp(complex(-math.pi * f0 / q, 2 * math.pi * f0) * self.dt)
+
+    # Envolvente de referencia : la de la portadora continua (50 %) en f0, estabilizada :
+    cycles = int(10 * q)
+    half = SAMPLES_PER_CYCLE // 2
+    self.reference = 1.0
+    self.reference = self.envelope([1.0 if (n % SAMPLES_PER_CYCLE) >= half else 0.0
+                                    for n in range(cycles * SAMPLES_PER_CYCLE)])[-1]
+
+  def envelope(self, samples) :
+    u"""
+    Devuelve la envolvente (relativa a la de referencia) de la salida del resonador.
+    """
+    y, pole, env = 0j, self.pole, []
+    for x in samples :
+      y = pole * y + x
+      env.append(abs(y) / self.reference)
+    return env
+
+  def sample(self, on, end) :
+    u"""
+    Devuelve la señal del LED (fracción de cada muestra en que emite) hasta 'end' seg.
+    """
+    samples = [0.0] * (int(end / self.dt) + 1)
+    for a, b in on :
+      n = int(a / self.dt)
+      while n < len(samples) and n * self.dt < b :
+        lo, hi = max(a, n * self.dt), min(b, (n + 1) * self.dt)
+        samples[n] += max(0.0, hi - lo) / self.dt
+        n += 1
+    return samples
+
+  def demodulate(self, on, tail=10e-3) :
+    u"""
+    Devuelve los intervalos (inicio, fin) en seg. en que la salida del receptor está
+    activa, para la emisión 'on' (PICModel.emit()).
+    """
+    if not on :
+      return []
+    env = self.envelope(self.sample(on, on[-1][1] + tail))
+
+    per_cycle = SAMPLES_PER_CYCLE
+    marks, active, count, start, agc = [], False, 0, 0.0, 0.0
+    for n, e in enumerate(env) :
+      gain = 1.0 / (1.0 + AGC_SLOPE * max(0.0, agc - self.agc_limit))
+      level = e * self.level * gain
+      if not active :
+        count = count + 1 if level >= 1.0 else 0
+        if count >= self.min_burst * per_cycle :
+          active, count, start = True, 0, n * self.dt
+      else :
+        count = count + 1 if level < THRESHOLD_OFF else 0
+        if count >= self.release * per_cycle :
+          active, count = False, 0
+          marks.append((start, n * self.dt))
+      agc += ((1.0 if active else 0.0) - agc) * self.dt / AGC_TAU
+
+    if active :
+      marks.append((start, len(env) * self.dt))
+    return marks
+
+
+def durations(marks) :
+  u"""
+  Devuelve las duraciones (uSeg.) alternadas de las marcas y los espacios de 'marks'
+  (sin el espacio final).
+  """
+  d = []
+  for n, (a, b) in enumerate(marks) :
+    if n :
+      d.append(1e6 * (a - marks[n - 1][1]))
+    d.append(1e6 * (b - a))
+  return d
+
+
+def margin(measured, nominal, tolerance=TOLERANCE) :
+  return 1.0 - abs(measured - nominal) / (tolerance * nominal + TICK_US)
+
+
+def decode_protocol(name, d, tolerance=TOLERANCE) :
+  u"""
+  Devuelve (bits, margen mínimo) de las duraciones 'd' con el protocolo 'name', o None si
+  no corresponden.
+  """
+  spec = PROTOCOLS[name]
+  if len(d) != 2 * spec['bits'] + 3 :
+    return None
+
+  margins = [margin(d[0], spec['header'][0], tolerance),
+             margin(d[1], spec['header'][1], tolerance)]
+  bits = 0
+  for n in range(spec['bits']) :
+    mark, space = d[2 + 2*n], d[3 + 2*n]
+    margins.append(margin(mark, spec['mark'], tolerance))
+    zero, one = margin(space, spec['zero'], tolerance), margin(space, spec['one'], tolerance)
+    margins.append(max(zero, one))
+    bits |= (one > zero) << n
+  margins.append(margin(d[-1], spec['mark'], tolerance))
+
+  if min(margins) < 0.0 :
+    return None
+  return bits, min(margins)
+
+
+def match(d, reference, tolerance=TOLERANCE) :
+  u"""
+  Devuelve el margen mínimo de las duraciones 'd' respecto de las del patrón de referencia
+  'reference', o None si no tienen el mismo número.
+  """
+  if len(d) != len(reference) :
+    return None
+  return min(margin(m, r, tolerance) for m, r in zip(d, reference))
+
+
+def decode(d, reference=None, tolerance=TOLERANCE) :
+  u"""
+  Devuelve {'protocol', 'bits', 'margin', 'ok'} de las duraciones 'd' : el protocolo que
+  las decodifica, o 'reference' si se comparan con las duraciones del patrón de referencia
+  'reference' (bits es None).
+  """
+  for name in sorted(PROTOCOLS) :
+    decoded = decode_protocol(name, d, tolerance)
+    if decoded is not None :
+      return {'protocol' : name, 'bits' : decoded[0], 'margin' : decoded[1], 'ok' : True}
+
+  m = match(d, reference, tolerance) if reference is not None else None
+  return {'protocol' : 'reference', 'bits' : None, 'margin' : m,
+          'ok' : m is not None and m >= 0.0}
+
+
+def pulse_distance(name, bits) :
+  u"""
+  Devuelve las duraciones (uSeg., con el espacio final) de la trama de 'bits' del protocolo
+  'name', para generar patrones de prueba.
+  """
+  spec = PROTOCOLS[name]
+  d = list(spec['header'])
+  for n in range(spec['bits']) :
+    d += [spec['mark'], spec['one'] if (bits >> n) & 1 else spec['zero']]
+  return d + [spec['mark'], 40000]
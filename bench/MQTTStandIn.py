@@ -0,0 +1,316 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto local del Broker MQTT y de la librería umqtt.simple, para el banco de pruebas.
+
+Implementa el subconjunto de MQTT 3.1.1 utilizado por IRProxy : CONNECT (con la última
+voluntad), SUBSCRIBE (con los comodines '+' y '#'), PUBLISH con QoS 0 (incluyendo mensajes
+retenidos), PINGREQ y DISCONNECT. No pretende ser un broker completo, solo evitar dependencias externas para
+medir la cadena completa en una sola PC.
+
+Incluye además un servidor de tiempo SNTP mínimo (TimeServer), con el reloj de la PC, para
+la sincronización del reloj del módulo ESP8266.
+"""
+
+import time
+import socket
+import struct
+import threading
+
+# Puerto utilizado por MQTTClient cuando no se especifica (el módulo ESP8266 no lo indica) :
+DEFAULT_PORT = 1883
+
+CONNECT, CONNACK, PUBLISH, SUBSCRIBE, SUBACK = 0x10, 0x20, 0x30, 0x80, 0x90
+PINGREQ, PINGRESP, DISCONNECT = 0xC0, 0xD0, 0xE0
+
+
+def encode_length(n) :
+  u"""
+  Devuelve la codificación de la longitud restante del paquete (también VLQ).
+  """
+  b = bytearray()
+  while True :
+    byte, n = n % 128, n // 128
+    b.append(byte | (0x80 if n > 0 else 0))
+    if n == 0 :
+      return bytes(b)
+
+
+def encode_str(s) :
+  if isinstance(s, str) :
+    s = s.encode('utf-8')
+  return struct.pack('!H', len(s)) + s
+
+
+def recv_exact(sock, n) :
+  data = b''
+  while len(data) < n :
+    chunk = sock.recv(n - len(data))
+    if not chunk :
+      raise OSError('Conexión cerrada')
+    data += chunk
+  return data
+
+
+def recv_packet(sock) :
+  u"""
+  Devuelve el tipo (byte de cabecera) y el contenido del siguiente paquete.
+  """
+  header = recv_exact(sock, 1)[0]
+  n, shift = 0, 0
+  while True :
+    b = recv_exact(sock, 1)[0]
+    n |= (b & 0x7F) << shift
+    shift += 7
+    if not (b & 0x80) :
+      break
+  return header, recv_exact(sock, n)
+
+
+def publish_packet(topic, msg, retain=False) :
+  body = encode_str(topic) + msg
+  return bytes([PUBLISH | (1 if retain else 0)]) + encode_length(len(body)) + body
+
+
+def read_str(body, i) :
+  u"""
+  Devuelve la cadena (bytes) que inicia en la posición 'i' del paquete y la posición que
+  le sigue.
+  """
+  n = struct.unpack('!H', body[i:i+2])[0]
+  return body[i+2:i+2+n], i + 2 + n
+
+
+def topic_matches(filter, topic) :
+  u"""
+  Verifica si el tópico coincide con el filtro de la suscripción.
+  """
+  f, t = filter.split('/'), topic.split('/')
+  for i, level in enumerate(f) :
+    if level == '#' :
+      return True
+    if i >= len(t) or (level != '+' and level != t[i]) :
+      return False
+  return len(f) == len(t)
+
+
+class Broker(object) :
+  u"""
+  Broker MQTT mínimo, cada conexión es atendida por un hilo.
+  """
+
+  def __init__(self, host='127.0.0.1', port=DEFAULT_PORT) :
+    self.server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    self.server.bind((host, port))
+    self.server.listen(16)
+    self.port = self.server.getsockname()[1]
+    self.lock = threading.Lock()
+    self.subscriptions = []
+    self.retained = {}
+    self.published = 0
+
+  def start(self) :
+    threading.Thread(target=self.serve, daemon=True).start()
+    return self
+
+  def serve(self) :
+    while True :
+      conn, addr = self.server.accept()
+      conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+      threading.Thread(target=self.session, args=(conn, threading.Lock()), daemon=True).start()
+
+  def send(self, conn, conn_lock, data) :
+    with conn_lock :
+      conn.sendall(data)
+
+  def route(self, topic, msg, retain=False) :
+    u"""
+    Entrega el mensaje a las suscripciones que coinciden con el tópico.
+    """
+    with self.lock :
+      self.published += 1
+      if retain :
+        self.retained[topic] = msg
+      targets = [(c, l) for f, c, l in self.subscriptions if topic_matches(f, topic)]
+    packet = publish_packet(topic, msg)
+    for c, l in set(targets) :
+      try :
+        self.send(c, l, packet)
+      except OSError :
+        pass
+
+  def session(self, conn, conn_lock) :
+    will = None
+    try :
+      while True :
+        header, body = recv_packet(conn)
+        kind = header & 0xF0
+        if kind == CONNECT :
+          flags = body[7]
+          client_id, i = read_str(body, 10)
+          if flags & 0x04 :
+            will_topic, i = read_str(body, i)
+            will_msg, i = read_str(body, i)
+            will = (will_topic.decode('utf-8'), will_msg, bool(flags & 0x20))
+          self.send(conn, conn_lock, bytes([CONNACK, 2, 0, 0]))
+
+        elif kind == SUBSCRIBE :
+          pid, i, granted = body[:2], 2, bytearray()
+          while i < len(body) :
+            n = struct.unpack('!H', body[i:i+2])[0]
+            filter = body[i+2:i+2+n].decode('utf-8')
+            i += 2 + n + 1
+            with self.lock :
+              self.subscriptions.append((filter, conn, conn_lock))
+              retained = [(t, m) for t, m in self.retained.items() if topic_matches(filter, t)]
+            granted.append(0)
+            for t, m in retained :
+              self.send(conn, conn_lock, publish_packet(t, m, retain=True))
+          self.send(conn, conn_lock, bytes([SUBACK, 2 + len(granted)]) + pid + bytes(granted))
+
+        elif kind == PUBLISH :
+          n = struct.unpack('!H', body[:2])[0]
+          topic = body[2:2+n].decode('utf-8')
+          msg = body[2+n:] if (header & 0x06) == 0 else body[4+n:]
+          self.route(topic, msg, bool(header & 0x01))
+
+        elif kind == PINGREQ :
+          self.send(conn, conn_lock, bytes([PINGRESP, 0]))
+
+        elif kind == DISCONNECT :
+          # La desconexión ordenada cancela la última voluntad :
+          will = None
+          break
+
+    except OSError :
+      pass
+
+    finally :
+      with self.lock :
+        self.subscriptions = [s for s in self.subscriptions if s[1] is not conn]
+      conn.close()
+      if will :
+        self.route(*will)
+
+
+class TimeServer(object) :
+  u"""
+  Servidor SNTP mínimo, responde cada solicitud con el reloj de la PC desplazado 'offset'
+  seg. (para simular un reloj desfasado).
+  """
+
+  NTP_DELTA = 2208988800
+
+  def __init__(self, host='127.0.0.1', port=0, offset=0.0) :
+    self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    self.sock.bind((host, port))
+    self.port = self.sock.getsockname()[1]
+    self.offset = offset
+    self.requests = 0
+
+  def start(self) :
+    threading.Thread(target=self.serve, daemon=True).start()
+    return self
+
+  def serve(self) :
+    while True :
+      request, addr = self.sock.recvfrom(48)
+      if len(request) < 48 :
+        continue
+      now = time.time() + self.offset + self.NTP_DELTA
+      seconds, fraction = int(now), int((now % 1) * (1 << 32))
+      stamp = struct.pack('!II', seconds, fraction)
+      # LI = 0, Versión 3, Modo 4 (servidor), estrato 1; el instante de la solicitud se
+      # devuelve como origen :
+      reply = bytes([0x1C, 1, 0, 0]) + bytes(20) + request[40:48] + stamp + stamp
+      self.requests += 1
+      self.sock.sendto(reply, addr)
+
+
+class MQTTClient(object) :
+  u"""
+  Cliente compatible con el interfaz de umqtt.simple.MQTTClient (el utilizado por el
+  módulo ESP8266), usado también por el generador de tráfico.
+  """
+
+  def __init__(self, client_id, server, port=0, user=None, password=None, keepalive=0,
+               ssl=False, ssl_params={}) :
+    self.client_id = client_id
+    self.server = server
+    self.port = port or DEFAULT_PORT
+    self.cb = None
+    self.sock = None
+    self.pid = 0
+    self.lw_topic = None
+
+  def set_last_will(self, topic, msg, retain=False, qos=0) :
+    self.lw_topic, self.lw_msg, self.lw_retain = topic, msg, retain
+
+  def set_callback(self, f) :
+    self.cb = f
+
+  def connect(self, clean_session=True) :
+    self.sock = socket.create_connection((self.server, self.port))
+    self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    flags = 0x02 if clean_session else 0
+    if self.lw_topic :
+      flags |= 0x04 | (0x20 if self.lw_retain else 0)
+    body = encode_str('MQTT') + bytes([4, flags]) + struct.pack('!H', 0)
+    body += encode_str(self.client_id)
+    if self.lw_topic :
+      body += encode_str(self.lw_topic) + encode_str(self.lw_msg)
+    self.sock.sendall(bytes([CONNECT]) + encode_length(len(body)) + body)
+    header, resp = recv_packet(self.sock)
+    if header != CONNACK or resp[1] != 0 :
+      raise OSError('Conexión rechazada')
+    return False
+
+  def disconnect(self) :
+    self.sock.sendall(bytes([DISCONNECT, 0]))
+    self.sock.close()
+
+  def ping(self) :
+    self.sock.sendall(bytes([PINGREQ, 0]))
+
+  def publish(self, topic, msg, retain=False, qos=0) :
+    if isinstance(topic, str) :
+      topic = topic.encode('utf-8')
+    if isinstance(msg, str) :
+      msg = msg.encode('utf-8')
+    self.sock.sendall(publish_packet(topic, msg, retain))
+
+  def subscribe(self, topic, qos=0) :
+    self.pid += 1
+    body = struct.pack('!H', self.pid) + encode_str(topic) + bytes([qos])
+    self.sock.sendall(bytes([SUBSCRIBE | 0x02]) + encode_length(len(body)) + body)
+    while True :
+      header, resp = self.wait_packet()
+      if header == SUBACK :
+        return
+
+  def wait_packet(self) :
+    header, body = recv_packet(self.sock)
+    if (header & 0xF0) == PUBLISH :
+      n = struct.unpack('!H', body[:2])[0]
+      if self.cb :
+        self.cb(body[2:2+n], body[2+n:])
+    return header, body
+
+  def wait_msg(self) :
+    self.sock.setblocking(True)
+    return self.wait_packet()[0]
+
+  def check_msg(self) :
+    u"""
+    Procesa a lo más un mensaje, sin bloquearse si no hay ninguno pendiente.
+    """
+    self.sock.setblocking(False)
+    try :
+      self.sock.recv(1, socket.MSG_PEEK)
+    except BlockingIOError :
+      return None
+    finally :
+      self.sock.setblocking(True)
+    return self.wait_msg()
@@ -0,0 +1,552 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Modelo del receptor/generador del microcontrolador (uC/IRProxy_uC.c) para el banco de
+pruebas.
+
+Reproduce las reglas de PatternRcveTask() : identificación del protocolo (versiones 1 y 2,
+con la base de tiempo), número de bytes de cada número VLQ y longitud máxima de cada tipo de mensaje (MAX_LEN, como en msg_table[]
+del microcontrolador). El microcontrolador recibe los mensajes en dos bancos (ping-pong) :
+un patrón recibido durante la emisión del anterior espera a que esta termine, y mientras
+tanto (hasta que inicia su emisión) los mensajes recibidos se pierden. Un mensaje
+incorrecto provoca la espera CLEARANCE_TIME sin actividad en el SPI
+(PatternRcveClearance()), durante la cual también se pierden los mensajes.
+
+Cada patrón se emite por las salidas seleccionadas con la opción PATTERN_OPT_OUTPUTS (la
+primera por omisión), las emisiones se cuentan por salida en counters['outputs']. La
+emisión inicia tras la demora PATTERN_OPT_DELAY, el instante de inicio de cada patrón
+emitido se registra en PICModel.starts (y el patrón en PICModel.start_frames).
+
+La repetición (REPEAT_ID) emite el último patrón recibido, si la verificación coincide; los
+demás mensajes se reciben en el otro banco y no lo alteran, como en el microcontrolador.
+La recepción continúa desde el inicio de la primera repetición : un patrón urgente
+(PATTERN_OPT_PRIORITY) cancela las repeticiones que no han iniciado (counters['aborted'],
+se descuentan de las emitidas), los demás esperan que terminen.
+
+La solicitud de aprendizaje (LEARN_ID) se atiende con la forma de onda sintética asignada
+a PICModel.waveform (lista de (high, low) en uSeg., como la entregaría el receptor), que
+se cuantifica con las mismas reglas que IRLearn(). El patrón resultante se entrega por
+PICModel.read() (machine.SPI.source) precedido por LEARN_SYNC, igual que IRLearnDump().
+
+Los eventos se registran como en el registro de eventos del microcontrolador (Trace()),
+que se devuelve, con el mismo formato, con la solicitud TRACE_ID.
+
+startup_time() reproduce la secuencia de arranque de main() (PS_STARTUP_DELAY_STAGE a
+PROXY_STAGE) para un perfil de la tensión de alimentación, con la resolución del tick
+(TICK_PERIOD), para comparar la espera supervisada (VddMonitor) con la fija anterior.
+
+emit() reproduce la forma de onda que IRCodeXmit() e IRCodeTask() generan en la salida
+(los intervalos en que el LED emite), con la cuantificación del periodo y del ciclo de
+trabajo de la portadora en CCP1/TMR2 y la latencia de la interrupción al conectar y
+desconectar la portadora (PPS), para validarla con el receptor de IRReceiver.py.
+"""
+
+import time
+import threading
+
+FOSC = 32e6
+IR_CODE_SIZE = 46
+CLEARANCE_TIME = 100e-3
+
+KEEPALIVE_ID = 0x7F
+RESETREQ_ID = 0x7E
+LEARN_ID = 0x7B
+REPEAT_ID = 0x7A
+INFRARED_REMOTE_PROXY_PROTOCOL = 0x01
+INFRARED_REMOTE_PROXY_PROTOCOL_2 = 0x02
+PATTERN_OPT_TIME_BASE = 0x01
+PATTERN_OPT_OUTPUTS = 0x02
+PATTERN_OPT_DELAY = 0x04
+PATTERN_OPT_PRIORITY = 0x08
+PATTERN_KINDS = (INFRARED_REMOTE_PROXY_PROTOCOL, INFRARED_REMOTE_PROXY_PROTOCOL_2)
+
+# Salidas (emisores) de la maqueta con el PIC16F1619 (IR_OUTPUTS), por omisión la primera :
+IR_OUTPUTS = 2
+DEFAULT_OUTPUTS = 0x01
+
+LEARN_TIMEOUT = 10.0
+LEARN_END_GAP = 60e-3
+LEARN_SYNC = 0xA5
+LEARN_MIN_PERIOD = 4
+LEARN_MAX_CYCLES = 0x3FFF
+TRACE_ID = 0x79
+TRACE_SYNC = 0x5A
+
+# Registro de eventos (Trace() en el microcontrolador) :
+TRACE_SIZE = 32
+TICK_PERIOD = 0.1
+SUBTICK_PERIOD = 16 / 31e3
+TRACE_RESET, TRACE_STAGE, TRACE_FRAME_START, TRACE_FRAME_END, TRACE_PARSE_ERROR, \
+  TRACE_CLEARANCE, TRACE_KEEPALIVE, TRACE_RESTART = range(1, 9)
+TRACE_ERRORS = {'incompleto' : 0x01, 'desborde' : 0x02, 'número demasiado largo' : 0x03,
+                'protocolo desconocido' : 0x04, 'carga inesperada' : 0x05,
+                'bytes sobrantes' : 0x04}
+POWER_ON_PCON = 0x3D
+PROXY_STAGE = 5
+
+# Longitud máxima de cada tipo de mensaje (bytes) :
+MAX_LEN = {KEEPALIVE_ID : 2, RESETREQ_ID : 2, TRACE_ID : 2, LEARN_ID : 6, REPEAT_ID : 3,
+           INFRARED_REMOTE_PROXY_PROTOCOL : IR_CODE_SIZE,
+           INFRARED_REMOTE_PROXY_PROTOCOL_2 : IR_CODE_SIZE}
+
+# Demora entre la solicitud de aprendizaje y la pulsación de la tecla (seg.) :
+LEARN_PRESS_DELAY = 0.5
+
+# Latencia (seg.) de la interrupción de TMR2 hasta la escritura del PPS en IRCodeTask(),
+# del orden de 50 ciclos de instrucción (FOSC/4) :
+ISR_LATENCY = 6e-6
+
+
+class FrameError(Exception) :
+  pass
+
+
+def read_number(frame, idx, max_len, limit=IR_CODE_SIZE) :
+  u"""
+  Devuelve el número VLQ que inicia en frame[idx] y el índice siguiente, con las mismas
+  restricciones que RcveNumber(max_len) para un mensaje de hasta 'limit' bytes.
+  """
+  num = 0
+  for i in range(max_len) :
+    if idx >= len(frame) or idx >= limit :
+      raise FrameError('incompleto' if idx < limit else 'desborde')
+    b = frame[idx]
+    num |= (b & 0x7F) << (7*i)
+    idx += 1
+    if not (b & 0x80) :
+      return num, idx
+  raise FrameError('número demasiado largo')
+
+
+def read_pattern(frame, idx, kind, limit=IR_CODE_SIZE) :
+  u"""
+  Devuelve los campos del patrón 'frame' de la versión 'kind', cuyo número de pulsos inicia
+  en frame[idx], como los decodifica IRCodeLoad() : {'period', 'duty', 'base', 'outputs',
+  'delay', 'priority', 'pulses' (duraciones en unidades de la base de tiempo)}, y el índice
+  siguiente.
+  """
+  num_pulses, idx = read_number(frame, idx, 1, limit)
+  options = 0
+  if kind == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    options, idx = read_number(frame, idx, 1, limit)
+  p = {'base' : 1, 'outputs' : DEFAULT_OUTPUTS, 'delay' : 0, 'priority' : 0}
+  p['period'], idx = read_number(frame, idx, 2, limit)
+  p['duty'], idx = read_number(frame, idx, 2, limit)
+  for bit in range(7) :
+    if options & (1 << bit) :
+      value, idx = read_number(frame, idx, 2, limit)
+      # Como en IRCodeLoad(), una base fuera de rango se ignora :
+      if (1 << bit) == PATTERN_OPT_TIME_BASE and 0 < value <= 0xFF :
+        p['base'] = value
+      elif (1 << bit) == PATTERN_OPT_OUTPUTS :
+        p['outputs'] = value & ((1 << IR_OUTPUTS) - 1)
+      elif (1 << bit) == PATTERN_OPT_DELAY :
+        p['delay'] = value
+      elif (1 << bit) == PATTERN_OPT_PRIORITY :
+        p['priority'] = value
+  p['pulses'] = []
+  for i in range(2*num_pulses) :
+    n, idx = read_number(frame, idx, 2, limit)
+    p['pulses'].append(n)
+  return p, idx
+
+
+def parse(frame) :
+  u"""
+  Devuelve el tipo de mensaje, la duración de la emisión (seg.) del mensaje 'frame' (con la
+  demora inicial), la máscara de las salidas por las que se emite (None si no es un patrón),
+  la demora (seg.) y la prioridad.
+  """
+  kind, idx = read_number(frame, 0, 1)
+  if kind not in MAX_LEN :
+    raise FrameError('protocolo desconocido')
+  limit = MAX_LEN[kind]
+
+  if kind in (KEEPALIVE_ID, RESETREQ_ID, TRACE_ID) :
+    size, idx = read_number(frame, idx, 1, limit)
+    if size != 0 :
+      raise FrameError('carga inesperada')
+    duration, outputs = 0.0, None
+
+  elif kind == REPEAT_ID :
+    count, idx = read_number(frame, idx, 1, limit)
+    check, idx = read_number(frame, idx, 1, limit)
+    duration, outputs = 0.0, None
+
+  elif kind == LEARN_ID :
+    size, idx = read_number(frame, idx, 1, limit)
+    period, idx = read_number(frame, idx, 2, limit)
+    duty, idx = read_number(frame, idx, 2, limit)
+    duration, outputs = 0.0, None
+
+  elif kind in PATTERN_KINDS :
+    p, idx = read_pattern(frame, idx, kind)
+    outputs, priority = p['outputs'], p['priority']
+    # El patrón dirigido a salidas inexistentes no se emite :
+    unit = p['base'] * p['period'] / FOSC
+    duration = (p['delay'] + sum(p['pulses'])) * unit if outputs else 0.0
+    delay = p['delay'] * unit
+
+  else :
+    raise FrameError('protocolo desconocido')
+
+  if idx != len(frame) :
+    raise FrameError('bytes sobrantes')
+
+  if kind not in PATTERN_KINDS :
+    delay, priority = 0.0, 0
+  return kind, duration, outputs, delay, priority
+
+
+def learn_quantize(t_us, period) :
+  return min((t_us * int(FOSC/1e6) + period // 2) // period, LEARN_MAX_CYCLES)
+
+
+def learn_frame(period, duty, waveform) :
+  u"""
+  Devuelve el patrón que IRLearn() obtiene de la forma de onda 'waveform' : el último
+  reposo (o el primero que excede LEARN_END_GAP) se reemplaza por LEARN_END_GAP, y se
+  descartan los pulsos que no caben en IR_CODE_SIZE bytes. Con un periodo menor que
+  LEARN_MIN_PERIOD se devuelve el patrón sin pulsos.
+  """
+  end_gap = int(LEARN_END_GAP * 1e6)
+  frame = bytearray()
+
+  def write(num) :
+    b = bytearray()
+    while num > 0x7F :
+      b.append(0x80 | (num & 0x7F))
+      num >>= 7
+    b.append(num)
+    if len(frame) + len(b) > IR_CODE_SIZE :
+      return False
+    frame.extend(b)
+    return True
+
+  write(INFRARED_REMOTE_PROXY_PROTOCOL)
+  n_idx = len(frame)
+  write(0)
+  write(period)
+  write(duty)
+  num_pulses, complete = 0, len(frame)
+  if period < LEARN_MIN_PERIOD :
+    waveform = []
+  for i, (high, low) in enumerate(waveform) :
+    if not write(learn_quantize(int(high), period)) :
+      break
+    last = (i == len(waveform) - 1) or low > end_gap
+    if not write(learn_quantize(end_gap if last else int(low), period)) :
+      break
+    num_pulses, complete = num_pulses + 1, len(frame)
+    if last :
+      break
+
+  frame[n_idx] = num_pulses
+  return bytes(frame[:complete])
+
+
+def emit(frame, latency=ISR_LATENCY, jitter=0.0, rng=None) :
+  u"""
+  Devuelve la lista de intervalos (inicio, fin) en seg., desde el inicio de la emisión, en
+  que el LED emite durante la emisión del patrón 'frame', y el periodo (seg.) de la
+  portadora generada. Cada conexión o desconexión de la portadora ocurre 'latency' seg.
+  (más un retardo aleatorio de hasta 'jitter' seg., de 'rng') después de la interrupción
+  de TMR2 que la provoca.
+  """
+  kind, idx = read_number(frame, 0, 1)
+  if kind not in PATTERN_KINDS :
+    raise FrameError('protocolo desconocido')
+  p, idx = read_pattern(frame, idx, kind, len(frame))
+  if not p['outputs'] or not p['pulses'] :
+    return [], 0.0
+
+  # PR2 = (periodo >> 2) - 1 con el pre-divisor 1:1 (FOSC/4), y CCPR1 el complemento del
+  # periodo activo : la salida queda en reposo (LED apagado) los primeros CCPR1 ciclos :
+  period = (p['period'] >> 2) * 4 / FOSC
+  idle = min(p['period'] - p['duty'], (p['period'] >> 2) * 4) / FOSC
+  isr = lambda k : k * period + latency + (rng.uniform(0.0, jitter) if jitter else 0.0)
+
+  # Conexiones (True) y desconexiones de la portadora, como en IRCodeTask() (el contador de
+  # cada duración es de 8 bits) :
+  switches = [] if p['delay'] else [(0.0, True)]
+  delay, pulses = p['delay'], p['pulses']
+  k, n, count = 0, 0, pulses[0] & 0xFF
+  while True :
+    k += p['base']
+    if delay :
+      delay -= 1
+      if delay == 0 :
+        switches.append((isr(k), True))
+      continue
+    count = (count - 1) & 0xFF
+    if count == 0 :
+      n += 1
+      if n >= len(pulses) :
+        switches.append((isr(k), False))
+        break
+      count = pulses[n] & 0xFF
+      switches.append((isr(k), n % 2 == 0))
+
+  # Periodos activos de la portadora mientras está conectada :
+  on = []
+  for (start, connected), (end, _) in zip(switches, switches[1:]) :
+    if not connected :
+      continue
+    c = int(start // period)
+    while c * period < end :
+      a, b = max(start, c * period + idle), min(end, (c + 1) * period)
+      if a < b :
+        on.append((a, b))
+      c += 1
+  return on, period
+
+
+# Supervisor de la tensión de alimentación (VddMonitor en el microcontrolador) : umbral de
+# regulación, tiempo en regulación y tiempo límite de cada espera del arranque (la espera
+# fija anterior era de STARTUP_FIXED_TICKS ticks) :
+VDD_REGULATION_MIN = 3.15
+VDD_STABLE_TIME = 0.2
+VDD_STARTUP_TIMEOUT = 1.0
+STARTUP_FIXED_TICKS = 10
+STARTUP_STEP = 1e-3
+
+
+def startup_time(vdd, supervised=True, limit=30.0) :
+  u"""
+  Devuelve el tiempo (seg.) desde el inicio de PS_STARTUP_DELAY_STAGE hasta PROXY_STAGE
+  para la tensión de alimentación vdd(t, inicio del pre-regulador o None), con la espera
+  supervisada por VDD (VddMonitor_isStable()) o con la espera fija anterior.
+  """
+  stable_ticks = int(VDD_STABLE_TIME / TICK_PERIOD)
+  timeout_ticks = int(VDD_STARTUP_TIMEOUT / TICK_PERIOD)
+  t, regulator = 0.0, None
+  for stage in ('PS_STARTUP_DELAY', 'EPS_STARTUP_DELAY') :
+    # Cada espera reinicia tick_cnt y la cuenta del tiempo en regulación :
+    start, stable_tick = t, 0
+    while t < limit :
+      tick = int((t - start) / TICK_PERIOD)
+      if supervised :
+        if vdd(t, regulator) < VDD_REGULATION_MIN :
+          stable_tick = tick
+        if tick - stable_tick >= stable_ticks or tick > timeout_ticks :
+          break
+      elif tick > STARTUP_FIXED_TICKS :
+        break
+      t += STARTUP_STEP
+    # PS_STARTUP_STAGE arranca el pre-regulador :
+    if regulator is None :
+      regulator = t
+  return round(t, 3)
+
+
+def vdd_profile(r1_level=3.3, r1_tau=0.15, vreg=3.3, reg_tau=0.05) :
+  u"""
+  Devuelve vdd(t, inicio del pre-regulador) : la tensión crece hacia 'r1_level' (alimentada
+  por R1) con la constante 'r1_tau', y desde el arranque del pre-regulador hacia 'vreg' con
+  la constante 'reg_tau' (seg.).
+  """
+  import math
+
+  def vdd(t, regulator) :
+    v = r1_level * (1.0 - math.exp(-t / r1_tau))
+    if regulator is not None and t >= regulator :
+      v0 = r1_level * (1.0 - math.exp(-regulator / r1_tau))
+      v = vreg - (vreg - v0) * math.exp(-(t - regulator) / reg_tau)
+    return v
+  return vdd
+
+
+class PICModel(object) :
+  u"""
+  Receptor conectado al SPI simulado (machine.SPI.sink), registra los eventos de cada
+  mensaje : (instante de recepción, mensaje, resultado, fin de la emisión).
+  """
+
+  def __init__(self) :
+    self.lock = threading.Lock()
+    self.busy_until = 0.0
+    self.tx_end = 0.0
+    self.events = []
+    self.starts = []
+    self.start_frames = []
+    self.counters = {'dump_burst' : 0, 'frames' : 0, 'transmitted' : 0, 'keepalive' : 0, 'reset_req' : 0, 'learn' : 0,
+                     'repeats' : 0, 'repeat_miss' : 0, 'spi_bytes' : 0, 'dropped_busy' : 0, 'dropped_clearance' : 0, 'rejected' : 0,
+                     'no_output' : 0, 'aborted' : 0, 'outputs' : [0] * IR_OUTPUTS}
+    self.clearance = False
+    self.waveform = None
+    self.learned = b''
+    self.learned_at = 0.0
+    self.retained = None
+    self.discarded = 0
+    self.series = None
+
+    # Arranque en frío hasta la etapa PROXY_STAGE :
+    self.trace = []
+    self.trace_start = time.monotonic()
+    self.trace_event(TRACE_RESET, POWER_ON_PCON, self.trace_start)
+    for stage in range(1, PROXY_STAGE + 1) :
+      self.trace_event(TRACE_STAGE, stage, self.trace_start)
+
+  def trace_event(self, event, arg, t) :
+    if event == TRACE_KEEPALIVE and self.trace and self.trace[-1][0] == TRACE_KEEPALIVE :
+      self.trace[-1] = (event, min(0xFF, self.trace[-1][1] + 1), t)
+    else :
+      self.trace = (self.trace + [(event, arg, t)])[-TRACE_SIZE:]
+
+  def trace_dump(self) :
+    u"""
+    Devuelve el registro de eventos como lo devuelve TraceMsg_handler().
+    """
+    entries = bytearray(5 * TRACE_SIZE)
+    count = len(self.trace)
+    for n, (event, arg, t) in enumerate(self.trace) :
+      ticks, rest = divmod(t - self.trace_start, TICK_PERIOD)
+      entries[5*n:5*n+5] = bytes((event, arg, int(ticks) & 0xFF, (int(ticks) >> 8) & 0xFF,
+                                  int(rest / SUBTICK_PERIOD)))
+    ticks = int((time.monotonic() - self.trace_start) / TICK_PERIOD)
+    head = bytes((5 + len(entries), count % TRACE_SIZE, count, ticks & 0xFF, (ticks >> 8) & 0xFF))
+    return head + bytes(entries)
+
+  def count_outputs(self, outputs, times) :
+    self.counters['transmitted'] += times
+    for i in range(IR_OUTPUTS) :
+      if outputs & (1 << i) :
+        self.counters['outputs'][i] += times
+
+  def abort_repeats(self, t) :
+    u"""
+    Cancela las repeticiones que no han iniciado en el instante 't', como PatternMsg_handler()
+    con un patrón urgente.
+    """
+    if self.series is None or t >= self.tx_end :
+      return
+    start, duration, outputs, repeated = self.series
+    done = max(1, int((t - start) // duration) + 1) if duration else len(repeated)
+    aborted = repeated[done:]
+    if not aborted :
+      return
+    for event in aborted :
+      self.events.remove(event)
+    self.count_outputs(outputs, -len(aborted))
+    self.counters['aborted'] += len(aborted)
+    self.tx_end = start + done*duration
+    self.series = None
+
+  def read(self, nbytes) :
+    u"""
+    Devuelve los bytes leídos por el módulo ESP8266 (ceros si no hay un patrón aprendido
+    o un registro de eventos pendiente). Como SPIDump() carga cada byte al sondear el SPI,
+    en una lectura en ráfaga solo el primero es válido y los siguientes se pierden (0xFF,
+    counters['dump_burst']).
+    """
+    with self.lock :
+      if not self.learned or time.monotonic() < self.learned_at :
+        return bytes(nbytes)
+      data, self.learned = self.learned[:1], self.learned[1:]
+      if nbytes > 1 :
+        self.counters['dump_burst'] += 1
+        data += bytes((0xFF,)) * (nbytes - 1)
+      if not self.learned :
+        self.busy_until = time.monotonic()
+      return data
+
+  def receive(self, frame) :
+    t = time.monotonic()
+    with self.lock :
+      self.counters['frames'] += 1
+      self.counters['spi_bytes'] += len(frame)
+      if t < self.busy_until :
+        # El microcontrolador esta emitiendo o esperando el cese de la actividad :
+        if self.clearance :
+          self.counters['dropped_clearance'] += 1
+          self.discarded += 1
+          self.busy_until = t + CLEARANCE_TIME
+        else :
+          self.counters['dropped_busy'] += 1
+        self.events.append((t, frame, 'dropped', None))
+        return
+
+      if self.clearance :
+        self.trace_event(TRACE_CLEARANCE, min(0xFF, self.discarded), self.busy_until)
+
+      if frame[0] in MAX_LEN and frame[0] not in (KEEPALIVE_ID, RESETREQ_ID, TRACE_ID) :
+        self.trace_event(TRACE_FRAME_START, frame[0], t)
+      try :
+        kind, duration, outputs, delay, priority = parse(frame)
+      except FrameError as e :
+        self.trace_event(TRACE_PARSE_ERROR, TRACE_ERRORS.get(str(e), 0), t)
+        self.discarded = 0
+        self.counters['rejected'] += 1
+        self.clearance = True
+        self.busy_until = t + CLEARANCE_TIME
+        self.events.append((t, frame, 'rejected: %s' % e, None))
+        return
+
+      self.clearance = False
+      if kind in PATTERN_KINDS and priority :
+        self.abort_repeats(t)
+      # Los patrones (y el aprendizaje) esperan el fin de la emisión en curso :
+      start = max(t, self.tx_end)
+      if kind in PATTERN_KINDS :
+        self.retained = frame
+        self.busy_until = start
+        if not outputs :
+          self.counters['no_output'] += 1
+          self.events.append((t, frame, 'no_output', None))
+          self.trace_event(TRACE_FRAME_END, len(frame), start)
+          return
+        self.count_outputs(outputs, 1)
+        self.starts.append(start + delay)
+        self.start_frames.append(frame)
+        self.tx_end = start + duration
+        self.events.append((t, frame, 'transmitted', self.tx_end))
+        self.trace_event(TRACE_FRAME_END, len(frame), start)
+      elif kind == REPEAT_ID :
+        self.counters['repeats'] += 1
+        retained = self.retained
+        if retained is None or frame[2] != sum(retained) & 0x7F :
+          self.counters['repeat_miss'] += 1
+          self.events.append((t, frame, 'repeat_miss', None))
+          self.trace_event(TRACE_FRAME_END, len(frame), t)
+          return
+        kind, duration, outputs, delay, priority = parse(retained)
+        # La demora solo precede a la primera emisión (IRCodeXmit() la consume) :
+        duration -= delay
+        if not outputs :
+          self.counters['no_output'] += 1
+          self.trace_event(TRACE_FRAME_END, len(frame), t)
+          return
+        self.count_outputs(outputs, frame[1])
+        repeated = [(t, retained, 'repeated', start + (i + 1)*duration) for i in range(frame[1])]
+        self.events.extend(repeated)
+        self.series = (start, duration, outputs, repeated)
+        self.busy_until = start
+        self.tx_end = start + frame[1]*duration
+        self.trace_event(TRACE_FRAME_END, len(frame), self.busy_until)
+      elif kind == LEARN_ID :
+        self.counters['learn'] += 1
+        carrier, idx = read_number(frame, 2, 2)
+        duty, idx = read_number(frame, idx, 2)
+        if self.waveform :
+          duration = LEARN_PRESS_DELAY + sum(h + l for h, l in self.waveform[:-1]) * 1e-6 \
+                     + self.waveform[-1][0] * 1e-6 + LEARN_END_GAP
+          self.learned = bytes([LEARN_SYNC]) + learn_frame(carrier, duty, self.waveform)
+        else :
+          duration = LEARN_TIMEOUT
+          self.learned = bytes([LEARN_SYNC]) + learn_frame(carrier, duty, [])
+        self.learned_at = start + duration
+        self.busy_until = start + duration + 1.0
+        self.events.append((t, frame, 'learn', self.learned_at))
+        self.trace_event(TRACE_FRAME_END, len(frame), self.learned_at)
+      elif kind == TRACE_ID :
+        # El primer byte leído es el último de la solicitud, luego el registro :
+        self.learned = bytes([0, TRACE_SYNC]) + self.trace_dump()
+        self.learned_at = t
+        self.busy_until = t + 1.0
+      elif kind == KEEPALIVE_ID :
+        self.counters['keepalive'] += 1
+        self.trace_event(TRACE_KEEPALIVE, 1, t)
+      else :
+        self.counters['reset_req'] += 1
+        self.trace_event(TRACE_RESTART, 0x03, t)
@@ -0,0 +1,109 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Medición del tiempo de CPU por mensaje del camino de re-dirección del módulo ESP8266
+(esp8266/IRProxy_uPy.py), con el SPI simulado (sin el modelo del microcontrolador) :
+
+  decode : conversión del mensaje (cifras hexadecimales) en bytes, con la implementación
+           anterior (before : expresión generadora con chr() e int() por cada byte) y con
+           la actual (after : decode_code(), con ubinascii.unhexlify()).
+  relay  : decodificación, interpretación del patrón (prioridad, duración y salidas de la
+           zona) y escritura en el SPI, con cada implementación de la decodificación.
+
+Los patrones son los del libro de códigos (pc/*.xml). Los tiempos son los del intérprete
+que ejecuta el banco ('implementation'), en CPython solo comparan las implementaciones y no
+anticipan los del módulo; no se han medido con MicroPython.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, como el de IRProxy_Bench.py.
+
+  python Relay_Bench.py --repeat 200 --compact
+"""
+
+import os
+import sys
+import time
+import argparse
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, BENCH_DIR)
+
+from IRProxy_Bench import commit_id, report
+import IRCodeBook
+import machine
+
+import IRProxy_uPy
+IRProxy_uPy.print = lambda *a, **k : None
+
+def decode_before(code_str) :
+  u"""
+  Decodificación de relay_code() anterior al buffer preasignado.
+  """
+  if len(code_str) % 2 :
+    return None
+  try :
+    return bytearray(int(chr(h1)+chr(h2), 16) for h1,h2 in zip(*[iter(code_str)]*2))
+  except ValueError :
+    return None
+
+
+def relay_path(decode, outputs) :
+  u"""
+  Devuelve la función que re-dirige un mensaje con la decodificación 'decode'.
+  """
+  def relay(code_str) :
+    data = decode(code_str)
+    IRProxy_uPy.pattern_priority(data)
+    IRProxy_uPy.pattern_duration_ms(data)
+    IRProxy_uPy.spi_write(IRProxy_uPy.route(data, outputs))
+  return relay
+
+
+def measure(fn, items, repeat) :
+  u"""
+  Devuelve el tiempo de CPU medio (uSeg.) de fn(item) sobre 'items', 'repeat' veces.
+  """
+  start = time.process_time()
+  for _ in range(repeat) :
+    for item in items :
+      fn(item)
+  return round(1e6 * (time.process_time() - start) / (repeat * len(items)), 3)
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Tiempo de CPU del camino de re-dirección.')
+  parser.add_argument('--patterns', default=os.path.join(REPO_DIR, 'pc'))
+  parser.add_argument('--compact', action='store_true', help='Patrones con base de tiempo (v2).')
+  parser.add_argument('--repeat', type=int, default=200, help='Repeticiones de la medición.')
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+
+  codes = [c.encode() for c in IRCodeBook.load(args.patterns, args.compact).values()]
+  if any(decode_before(c) != IRProxy_uPy.decode_code(c) for c in codes) :
+    print('Las decodificaciones no coinciden.')
+    sys.exit(1)
+
+  # SPI simulado : sin el modelo del microcontrolador ni la duración de la escritura :
+  machine.SPI.sink = None
+  IRProxy_uPy.hspi.baudrate = float('inf')
+  outputs = min(IRProxy_uPy.zones.values()) if IRProxy_uPy.zones else 0x01
+
+  result = {
+    'commit' : commit_id(),
+    'implementation' : sys.implementation.name,
+    'compact' : args.compact,
+    'patterns' : len(codes),
+    'code_bytes' : sum(len(c) // 2 for c in codes),
+  }
+  for name, decode in (('before', decode_before), ('after', IRProxy_uPy.decode_code)) :
+    result[name] = {
+      'decode_us' : measure(decode, codes, args.repeat),
+      'relay_us' : measure(relay_path(decode, outputs), codes, args.repeat),
+    }
+  report(result, args.output)
+
+
+if __name__ == '__main__' :
+  main()
@@ -0,0 +1,53 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Tiempo de arranque del microcontrolador hasta PROXY_STAGE (PICModel.startup_time()), con la
+espera supervisada por la tensión de alimentación (VddMonitor) y con la espera fija
+anterior (11 ticks por etapa), para los perfiles de la tensión :
+
+  nominal : la tensión alimentada por R1 alcanza la regulación en unos 0.4 seg.
+  slow    : R1 con una constante de tiempo 4 veces mayor.
+  low     : la tensión alimentada por R1 no alcanza VDD_REGULATION_MIN (tiempo límite en
+            la primera espera).
+  never   : la tensión nunca alcanza la regulación (tiempo límite en ambas esperas).
+
+Es un modelo de la secuencia de main(), no una medición en el equipo. El resultado se
+imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON, con la
+identificación del commit, como el de IRProxy_Bench.py.
+
+  python Startup_Bench.py
+"""
+
+import os
+import sys
+import argparse
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, BENCH_DIR)
+
+import PICModel
+from IRProxy_Bench import commit_id, report
+
+PROFILES = {
+  'nominal' : PICModel.vdd_profile(),
+  'slow' : PICModel.vdd_profile(r1_tau=0.6),
+  'low' : PICModel.vdd_profile(r1_level=3.0),
+  'never' : PICModel.vdd_profile(r1_level=3.0, vreg=3.1),
+}
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Tiempo de arranque hasta PROXY_STAGE.')
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+
+  result = {'commit' : commit_id(), 'timeout_s' : PICModel.VDD_STARTUP_TIMEOUT}
+  for name, vdd in sorted(PROFILES.items()) :
+    result[name] = {'supervised_s' : PICModel.startup_time(vdd),
+                    'fixed_s' : PICModel.startup_time(vdd, supervised=False)}
+  report(result, args.output)
+
+
+if __name__ == '__main__' :
+  main()
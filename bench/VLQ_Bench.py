@@ -0,0 +1,123 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Verificación y medición de la codificación VLQ compartida (codec/vlq.c) :
+
+  1. Los vectores de referencia (codec/vectors.txt) se verifican con la biblioteca, cargada
+     por pc/IRCodec.py, y con la implementación en Python equivalente.
+  2. Se mide el tiempo por mensaje de la codificación, decodificación y verificación de
+     los patrones del libro de códigos (pc/*.xml) con cada implementación.
+
+El resultado se imprime (y opcionalmente se agrega al archivo OUTPUT) como una línea JSON,
+con la identificación del commit, como el de IRProxy_Bench.py.
+
+  python VLQ_Bench.py --repeat 2000
+"""
+
+import os
+import sys
+import time
+import argparse
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+sys.path.insert(0, BENCH_DIR)
+sys.path.insert(1, os.path.join(REPO_DIR, 'pc'))
+
+import IRCodec
+import IRCodeBook
+from IRProxy_Bench import commit_id, report
+
+VECTORS = os.path.join(REPO_DIR, 'codec', 'vectors.txt')
+
+
+def backends() :
+  u"""
+  Devuelve las implementaciones disponibles {nombre : biblioteca (None para Python)}.
+  """
+  available = {'python' : None}
+  if IRCodec._lib is not None :
+    available['c'] = IRCodec._lib
+  return available
+
+
+def use(lib) :
+  IRCodec._lib = lib
+
+
+def verify() :
+  u"""
+  Devuelve la lista de vectores de referencia que no se cumplen, como (línea, obtenido).
+  """
+  failures = []
+  with open(VECTORS) as f :
+    for n, line in enumerate(f, 1) :
+      line = line.strip()
+      if not line or line.startswith('#') :
+        continue
+
+      kind, value, expected = line.split()
+      if kind == 'num' :
+        got = IRCodec.encode_num(int(value))
+      elif kind == 'frame' :
+        try :
+          got = ','.join(str(num) for num in IRCodec.decode_frame(value))
+          # La codificación de los números leídos debe reproducir el mensaje :
+          if IRCodec.encode_frame(IRCodec.decode_frame(value)) != value :
+            got = 'reencode:' + got
+        except ValueError :
+          got = 'invalid'
+      else :
+        got = IRCodec.ERRORS.get(IRCodec.check_pattern(value), 'ok')
+
+      if got != expected :
+        failures.append((n, got))
+
+  return failures
+
+
+def measure(fn, items, repeat) :
+  u"""
+  Devuelve el tiempo medio (uSeg.) de fn(item) sobre 'items', 'repeat' veces.
+  """
+  start = time.perf_counter()
+  for _ in range(repeat) :
+    for item in items :
+      fn(item)
+  return round(1e6 * (time.perf_counter() - start) / (repeat * len(items)), 3)
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Verificación y medición del codec VLQ.')
+  parser.add_argument('--repeat', type=int, default=500, help='Repeticiones de la medición.')
+  parser.add_argument('--output', default=None, help='Archivo al que se agregan los resultados.')
+  args = parser.parse_args()
+
+  patterns = [IRCodeBook.read_pattern(f) for f in
+              sorted(IRCodeBook.glob.glob(os.path.join(REPO_DIR, 'pc', '*.xml')))]
+  codes = [IRCodeBook.encode_pattern(*p) for p in patterns]
+  numbers = [IRCodec.decode_frame(c) for c in codes]
+
+  result = {'commit' : commit_id(), 'vectors' : VECTORS, 'patterns' : len(codes)}
+  saved = IRCodec._lib
+  for name, lib in sorted(backends().items()) :
+    use(lib)
+    failures = verify()
+    result[name] = {
+      'vectors_ok' : not failures,
+      'failures' : failures,
+      'encode_us' : measure(IRCodec.encode_frame, numbers, args.repeat),
+      'decode_us' : measure(IRCodec.decode_frame, codes, args.repeat),
+      'check_us' : measure(IRCodec.check_pattern, codes, args.repeat),
+    }
+  use(saved)
+
+  result['backend'] = IRCodec.BACKEND
+  report(result, args.output)
+  if any(not result[name]['vectors_ok'] for name in backends()) :
+    sys.exit(1)
+
+
+if __name__ == '__main__' :
+  main()
@@ -0,0 +1,52 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'machine' de MicroPython para el banco de pruebas. La escritura en el
+SPI se entrega al receptor asignado a SPI.sink (el modelo del microcontrolador), y la
+lectura se obtiene de SPI.source.
+"""
+
+import time
+
+
+class Pin(object) :
+  IN, OUT = 0, 1
+
+  def __init__(self, id, mode=-1) :
+    self.id = id
+    self.state = 0
+
+  def on(self) :
+    self.state = 1
+
+  def off(self) :
+    self.state = 0
+
+  def value(self, v=None) :
+    if v is None :
+      return self.state
+    self.state = v
+
+
+class SPI(object) :
+  sink = None
+  source = None
+
+  def __init__(self, id, baudrate=1000000, polarity=0, phase=0) :
+    self.baudrate = baudrate
+
+  def write(self, buf) :
+    # La escritura del módulo ESP8266 es síncrona, se emula su duración :
+    time.sleep(8.0 * len(buf) / self.baudrate)
+    if SPI.sink :
+      SPI.sink(bytes(buf))
+
+  def read(self, nbytes, write=0x00) :
+    time.sleep(8.0 * nbytes / self.baudrate)
+    if SPI.source :
+      return SPI.source(nbytes)
+    return bytes(nbytes)
+
+
+def reset() :
+  raise SystemExit('machine.reset()')
@@ -0,0 +1,37 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'network' de MicroPython, la conexión Wifi siempre está activa.
+"""
+
+from secrets import WIFI_SSID
+
+STA_IF, AP_IF = 0, 1
+
+
+class WLAN(object) :
+  connected = True
+
+  def __init__(self, interface) :
+    self.interface = interface
+
+  def active(self, state=None) :
+    return True
+
+  def connect(self, ssid, password) :
+    pass
+
+  def isconnected(self) :
+    return WLAN.connected
+
+  def config(self, param) :
+    return {'essid' : WIFI_SSID, 'mac' : b'\x02\x00\x00\x00\x00\x01'}[param]
+
+  def status(self, param=None) :
+    return {'rssi' : -55}[param] if param else 5
+
+  def ifconfig(self) :
+    return ('127.0.0.1', '255.0.0.0', '127.0.0.1', '127.0.0.1')
+
+  def scan(self) :
+    return []
@@ -0,0 +1,9 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'ntptime' de MicroPython, el reloj de la PC ya esta sincronizado.
+"""
+
+
+def settime() :
+  pass
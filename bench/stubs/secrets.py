@@ -0,0 +1,30 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Configuración del banco de pruebas (equivalente al archivo secrets del módulo ESP8266).
+"""
+
+WIFI_SSID   = 'IRProxyBench'
+WIFI_PSW    = ''
+MQTT_BROKER = '127.0.0.1'
+MQTT_PORT   = 1883
+WEBREPL_PSW = ''
+
+# Recepción directa por UDP (puerto 0 : asignado por el sistema) :
+UDP_PORT    = 0
+UDP_KEY     = 'IRProxyBench'
+
+# Estado de salud cada seg., para que se publique durante las pruebas :
+HEALTH_PERIOD_MS = 1000
+
+# Zonas (emisores del microcontrolador) : {nombre : máscara de salidas} :
+IR_ZONES    = {'deco_tv' : 0x01, 'tv' : 0x02, 'all' : 0x03}
+
+# Tópicos del equipo : ir_proxy/<sitio>/<cuarto>/<equipo>, y grupos a los que pertenece :
+IR_SITE     = 'casa'
+IR_ROOM     = 'banco'
+IR_DEVICE   = 'deco_tv'
+IR_GROUPS   = ['tvs']
+
+# Teclas urgentes de los clientes de la PC (IRCodeBook.urgent_keys()) :
+IR_URGENT_KEYS = ['Audio']
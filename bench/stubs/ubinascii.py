@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'ubinascii' de MicroPython.
+"""
+
+from binascii import hexlify, unhexlify
@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'uhashlib' de MicroPython.
+"""
+
+from hashlib import sha1, sha256
@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'ujson' de MicroPython.
+"""
+
+from json import dumps, loads
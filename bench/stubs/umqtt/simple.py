@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto de la librería umqtt.simple de MicroPython.
+"""
+
+from MQTTStandIn import MQTTClient
@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'uselect' de MicroPython.
+"""
+
+from select import *
@@ -0,0 +1,7 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'usocket' de MicroPython.
+"""
+
+from socket import *
@@ -0,0 +1,38 @@
+# -*- coding: UTF-8 -*-
+
+u"""
+Sustituto del módulo 'utime' de MicroPython.
+"""
+
+import time as _time
+
+sleep = _time.sleep
+
+
+def sleep_ms(ms) :
+  _time.sleep(ms / 1e3)
+
+
+def sleep_us(us) :
+  _time.sleep(us / 1e6)
+
+
+def time() :
+  # Segundos desde el inicio de la época de MicroPython (2000) :
+  return int(_time.time()) - 946684800
+
+
+def ticks_ms() :
+  return int(_time.monotonic() * 1e3)
+
+
+def ticks_us() :
+  return int(_time.monotonic() * 1e6)
+
+
+def ticks_diff(a, b) :
+  return a - b
+
+
+def ticks_add(a, b) :
+  return a + b
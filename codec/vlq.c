@@ -0,0 +1,160 @@
+/* vlq.c
+ *
+ * Codificación VLQ de los mensajes del Protocolo de Mando Remoto por Señales Infrarrojas
+ * (ver vlq.h).
+ */
+
+#include "vlq.h"
+
+
+uint8_t vlq_encode(vlq_num_t num, uint8_t *buf, uint16_t size) {
+uint8_t n ;
+  n = 0 ;
+  while (num > 0x7F) {
+    if (n >= size) return 0 ;
+    buf[n++] = 0x80 | (uint8_t)(num & 0x7F) ;
+    num >>= 7 ;
+  }
+
+  if (n >= size) return 0 ;
+  buf[n++] = (uint8_t)num ;
+  return n ;
+}
+
+
+uint8_t vlq_decode(const uint8_t *buf, uint16_t len, uint8_t max_bytes, vlq_num_t *num) {
+uint8_t n, b ;
+  *num = 0 ;
+  if (max_bytes > VLQ_MAX_BYTES) max_bytes = VLQ_MAX_BYTES ;
+
+  for (n = 0 ; (n < max_bytes) && (n < len) ; n++) {
+    b = buf[n] ;
+    *num |= ((vlq_num_t)(b & 0x7F)) << (7 * n) ;
+    if ((b & 0x80) == 0x00) return n + 1 ;
+  }
+
+  /* Número incompleto o con más bytes que los admitidos : */
+  return 0 ;
+}
+
+
+uint16_t vlq_encode_frame(const vlq_num_t *nums, uint16_t count, uint8_t *buf, uint16_t size) {
+uint16_t i, len ;
+uint8_t n ;
+  len = 0 ;
+  for (i = 0 ; i < count ; i++) {
+    n = vlq_encode(nums[i], buf + len, size - len) ;
+    if (n == 0) return VLQ_INVALID ;
+    len += n ;
+  }
+
+  return len ;
+}
+
+
+uint16_t vlq_decode_frame(const uint8_t *buf, uint16_t len, vlq_num_t *nums, uint16_t max_count) {
+uint16_t idx, count ;
+uint8_t n ;
+  idx = count = 0 ;
+  while (idx < len) {
+    if (count >= max_count) return VLQ_INVALID ;
+    n = vlq_decode(buf + idx, len - idx, VLQ_MAX_BYTES, &nums[count++]) ;
+    if (n == 0) return VLQ_INVALID ;
+    idx += n ;
+  }
+
+  return count ;
+}
+
+
+/* Lee el siguiente número del patrón para vlq_check_pattern(), byte por byte como
+ * RcveNumber() : devuelve VLQ_OK o el código del error.
+ */
+static uint8_t check_number(const uint8_t *frame, uint16_t len, uint16_t *idx,
+                            uint8_t max_bytes, vlq_num_t *num) {
+uint8_t n, b ;
+  *num = 0 ;
+  for (n = 0 ; n < max_bytes ; n++) {
+    if (*idx >= VLQ_PATTERN_SIZE) return VLQ_ERR_OVERFLOW ;
+    if (*idx >= len) return VLQ_ERR_INCOMPLETE ;
+
+    b = frame[(*idx)++] ;
+    *num |= ((vlq_num_t)(b & 0x7F)) << (7 * n) ;
+    if ((b & 0x80) == 0x00) return VLQ_OK ;
+  }
+
+  return VLQ_ERR_NUMBER ;
+}
+
+
+uint8_t vlq_check_pattern(const uint8_t *frame, uint16_t len) {
+uint16_t idx, i ;
+vlq_num_t version, num_pulses, options, num ;
+uint8_t err, bit ;
+  idx = 0 ;
+  if ((err = check_number(frame, len, &idx, 1, &version)) != VLQ_OK) return err ;
+  if ((version != VLQ_PROTOCOL) && (version != VLQ_PROTOCOL_2)) return VLQ_ERR_UNKNOWN ;
+
+  if ((err = check_number(frame, len, &idx, 1, &num_pulses)) != VLQ_OK) return err ;
+  options = 0 ;
+  if (version == VLQ_PROTOCOL_2) {
+    if ((err = check_number(frame, len, &idx, 1, &options)) != VLQ_OK) return err ;
+  }
+
+  /* Periodo y periodo activo de la portadora, el valor de cada opción y los pulsos : */
+  for (i = 0 ; i < 2 ; i++) {
+    if ((err = check_number(frame, len, &idx, VLQ_NUMBER_BYTES, &num)) != VLQ_OK) return err ;
+  }
+  for (bit = 0 ; bit < 7 ; bit++) {
+    if ((options & (1 << bit)) == 0) continue ;
+    if ((err = check_number(frame, len, &idx, VLQ_NUMBER_BYTES, &num)) != VLQ_OK) return err ;
+  }
+  for (i = 0 ; i < (uint16_t)(2 * num_pulses) ; i++) {
+    if ((err = check_number(frame, len, &idx, VLQ_NUMBER_BYTES, &num)) != VLQ_OK) return err ;
+  }
+
+  return (idx == len) ? VLQ_OK : VLQ_ERR_PAYLOAD ;
+}
+
+
+#if !defined(__XC8)
+
+static const char hex_digits[] = "0123456789ABCDEF" ;
+
+uint16_t vlq_to_hex(const uint8_t *frame, uint16_t len, char *hex, uint16_t size) {
+uint16_t i ;
+  if ((uint32_t)2 * len + 1 > size) return VLQ_INVALID ;
+
+  for (i = 0 ; i < len ; i++) {
+    hex[2*i]     = hex_digits[frame[i] >> 4] ;
+    hex[2*i + 1] = hex_digits[frame[i] & 0x0F] ;
+  }
+  hex[2*len] = '\0' ;
+  return 2 * len ;
+}
+
+
+static int hex_value(char c) {
+  if ((c >= '0') && (c <= '9')) return c - '0' ;
+  if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10 ;
+  if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10 ;
+  return -1 ;
+}
+
+
+uint16_t vlq_from_hex(const char *hex, uint16_t hex_len, uint8_t *frame, uint16_t size) {
+uint16_t i ;
+int high, low ;
+  if ((hex_len % 2) != 0 || (hex_len / 2) > size) return VLQ_INVALID ;
+
+  for (i = 0 ; i < hex_len / 2 ; i++) {
+    high = hex_value(hex[2*i]) ;
+    low = hex_value(hex[2*i + 1]) ;
+    if ((high < 0) || (low < 0)) return VLQ_INVALID ;
+    frame[i] = (uint8_t)((high << 4) | low) ;
+  }
+
+  return hex_len / 2 ;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/* vlq.h
+ *
+ * Codificación VLQ de los mensajes del Protocolo de Mando Remoto por Señales Infrarrojas,
+ * compartida por el microcontrolador (uC/IRProxy_uC.c, se compila con el proyecto
+ * IRProxy.X) y por las herramientas de la PC (pc/IRCodec.py la carga por ctypes).
+ *
+ * Cada número se codifica en base 128, desde la cifra de menor peso, con el bit 7 activo
+ * en todos los bytes salvo el último. No utiliza memoria dinámica : los números y los
+ * mensajes se leen y escriben en los buffers del invocador, cuyo tamaño se indica siempre.
+ */
+
+#ifndef VLQ_H
+#define VLQ_H
+
+#include <stdint.h>
+
+/* El microcontrolador solo maneja números de hasta 2 bytes (0x3FFF), en la PC también los
+ * instantes en mseg. desde 1970 (STAMP_ID y AT_ID) :
+ */
+#if defined(__XC8)
+typedef uint16_t vlq_num_t ;
+#define VLQ_MAX_BYTES         (3)
+#else
+typedef uint64_t vlq_num_t ;
+#define VLQ_MAX_BYTES         (10)
+#endif
+
+/* Límites de la recepción en el microcontrolador (PatternRcveTask()) : */
+#define VLQ_PATTERN_SIZE      (46)    /* Bytes del patrón (irCodeRX).                   */
+#define VLQ_NUMBER_BYTES      (2)     /* Bytes de cada número del patrón.               */
+
+#define VLQ_PROTOCOL          (0x01)
+#define VLQ_PROTOCOL_2        (0x02)
+
+/* Resultados de vlq_check_pattern(), los mismos códigos que TRACE_ERR_x : */
+#define VLQ_OK                (0)
+#define VLQ_ERR_INCOMPLETE    (1)     /* El mensaje termina antes de lo esperado.       */
+#define VLQ_ERR_OVERFLOW      (2)     /* Excede VLQ_PATTERN_SIZE bytes.                 */
+#define VLQ_ERR_NUMBER        (3)     /* Número con más bytes que los admitidos.        */
+#define VLQ_ERR_UNKNOWN       (4)     /* No es un patrón (versión 1 o 2).               */
+#define VLQ_ERR_PAYLOAD       (5)     /* Bytes sobrantes.                               */
+
+#define VLQ_INVALID           (0xFFFF)
+
+/* Escribe el número 'num' en 'buf' (de 'size' bytes), devuelve los bytes escritos o 0 si
+ * no caben :
+ */
+uint8_t vlq_encode(vlq_num_t num, uint8_t *buf, uint16_t size) ;
+
+/* Lee en 'num' el número que inicia en 'buf' (de 'len' bytes), de a lo más 'max_bytes'
+ * bytes, devuelve los bytes leídos o 0 si el número está incompleto o es más largo :
+ */
+uint8_t vlq_decode(const uint8_t *buf, uint16_t len, uint8_t max_bytes, vlq_num_t *num) ;
+
+/* Escribe los 'count' números de 'nums' en 'buf', devuelve la longitud del mensaje o
+ * VLQ_INVALID si no cabe :
+ */
+uint16_t vlq_encode_frame(const vlq_num_t *nums, uint16_t count, uint8_t *buf, uint16_t size) ;
+
+/* Lee en 'nums' (de 'max_count' números) los números del mensaje 'buf' de 'len' bytes,
+ * devuelve cuántos leyó o VLQ_INVALID si el mensaje termina con un número incompleto o
+ * tiene más números :
+ */
+uint16_t vlq_decode_frame(const uint8_t *buf, uint16_t len, vlq_num_t *nums, uint16_t max_count) ;
+
+/* Verifica el patrón (versión 1 o 2) 'frame' de 'len' bytes con las reglas del
+ * microcontrolador, devuelve VLQ_OK o el código VLQ_ERR_x :
+ */
+uint8_t vlq_check_pattern(const uint8_t *frame, uint16_t len) ;
+
+#if !defined(__XC8)
+/* Conversión del mensaje binario a su representación hexadecimal (la publicada por MQTT) y
+ * viceversa. vlq_to_hex() agrega el terminador y devuelve el número de cifras, o
+ * VLQ_INVALID si no caben; vlq_from_hex() devuelve la longitud del mensaje, o VLQ_INVALID
+ * si el texto no es hexadecimal, su longitud es impar o no cabe :
+ */
+uint16_t vlq_to_hex(const uint8_t *frame, uint16_t len, char *hex, uint16_t size) ;
+uint16_t vlq_from_hex(const char *hex, uint16_t hex_len, uint8_t *frame, uint16_t size) ;
+#endif
+
+#endif
@@ -4,8 +4,15 @@
 # ir_proxy_py.py
 # Version 0.3.0
 
+import gc
 import utime
+import ujson
 import network
+import usocket
+import uselect
+import uhashlib
+import ubinascii
+import ntptime
 from machine import Pin, SPI
 from umqtt.simple import MQTTClient
 from secrets import *
@@ -14,10 +21,97 @@ from secrets import *
 RESET_REQ_CODE   = b'\x7E\x00'
 KEEPALIVE_CODE   = b'\x7F\x00'
 
+INFRARED_REMOTE_PROXY_PROTOCOL = 0x01
+
+# La versión 2 agrega la máscara de opciones (con la base de tiempo de las duraciones) :
+INFRARED_REMOTE_PROXY_PROTOCOL_2 = 0x02
+PATTERN_OPT_TIME_BASE = 0x01
+PATTERN_OPT_OUTPUTS = 0x02
+PATTERN_OPT_DELAY = 0x04
+PATTERN_OPT_PRIORITY = 0x08
+
+# Mensajes interpretados por el propio módulo (no se re-dirigen al microcontrolador) :
+MACRO_ID         = 0x7D
+
+# Repetición del último patrón emitido : [REPEAT_ID] [Veces] [Verificación], donde la 
+# verificación es la suma de los bytes del patrón (7 bits) para que el microcontrolador 
+# confirme que aun lo conserva. Los patrones idénticos que llegan antes de REPEAT_WINDOW_MS
+# del fin de la emisión anterior se envían así, y los que llegan mientras el 
+# microcontrolador todavía emite se acumulan en una sola repetición (hasta REPEAT_MAX) :
+REPEAT_ID        = 0x7A
+REPEAT_WINDOW_MS = 1000
+REPEAT_MAX       = 127
+last_frame = None
+repeat_pending = 0
+repeat_msg = bytearray((REPEAT_ID, 0, 0))
+
+# Fin estimado de la emisión en curso (last_end) y de su inicio (last_start) : el
+# microcontrolador recibe cada patrón en uno de dos bancos, por lo que el siguiente se puede
+# enviar en cuanto inicia la emisión del anterior (wait_bank()), y su emisión inicia al
+# terminar la de este :
+last_end = 0
+last_start = 0
+
+# Carriles de prioridad : los patrones y los pasos de las macros esperan en el carril normal
+# (lane, hasta LANE_MAX mensajes como (espera, patrón, instante de llegada), la espera es 
+# None para los patrones) y se envían en orden, sin bloquear la recepción, en cuanto el
+# microcontrolador tiene un banco libre (lane_task()). Los patrones urgentes (con prioridad,
+# PATTERN_OPT_PRIORITY) no esperan en el carril : cancelan las repeticiones acumuladas y se
+# envían en cuanto el microcontrolador puede recibirlos (rcve_free, el inicio de la última
+# emisión solicitada o de su primera repetición), y este cancela las repeticiones
+# pendientes (repeat_series, inicio, duración y veces) al terminar la repetición en curso :
+LANE_MAX = 32
+lane = []
+rcve_free = 0
+repeat_series = None
+
+# Solicitud de aprendizaje de un patrón, el microcontrolador devuelve el patrón capturado
+# precedido por LEARN_SYNC, se espera hasta LEARN_WAIT_MS (mayor que LEARN_TIMEOUT en el
+# microcontrolador) verificando cada LEARN_POLL_MS. El patrón se publica en el tópico
+# <topic>/learned. Las solicitudes con un periodo menor que LEARN_MIN_PERIOD se descartan :
+LEARN_ID         = 0x7B
+LEARN_SYNC       = 0xA5
+LEARN_MIN_PERIOD = 4
+LEARN_WAIT_MS    = 12000
+LEARN_POLL_MS    = 5
+
+# Solicitud del registro de eventos del microcontrolador : [TRACE_ID] [0], lo devuelve 
+# precedido por TRACE_SYNC y su longitud, y se publica en el tópico <topic>/trace :
+TRACE_ID         = 0x79
+TRACE_SYNC       = 0x5A
+TRACE_WAIT_MS    = 500
+
+# El microcontrolador carga cada byte del patrón aprendido o del registro (SPIDump()) al
+# sondear el SPI entre sus demás tareas, por lo que no sigue una lectura en ráfaga : los
+# bytes se leen de a uno, separados por SPI_DUMP_GAP_US :
+SPI_DUMP_GAP_US  = 50
+
+# Frecuencia del oscilador del microcontrolador, unidad del periodo de la portadora :
+FOSC = 32000000
+
+# Límites de la recepción en el microcontrolador (tamaño del patrón y de sus números), y
+# tiempo de espera sin actividad tras un mensaje rechazado (mseg.) :
+IR_CODE_SIZE = 46
+MAX_NUMBER = 1 << 14
+CLEARANCE_MS = 100
+
+# Margen (en mseg.) entre el fin estimado de la emisión de un patrón y el envío del siguiente,
+# para que el microcontrolador retome la recepción :
+MACRO_GUARD_MS = 2
+
 # Se debe enviar el código guardián (KEEPALIVE_CODE), antes que transcurra el periodo especificado
-# (KEEPALIVE_PERIOD), desde la última transmisión , se utiliza keepalive_cnt para medir este tiempo :
+# (KEEPALIVE_PERIOD), desde la última transmisión , se utiliza keepalive_ref (instante de la última
+# transmisión en mseg.) para medir este tiempo :
 KEEPALIVE_PERIOD = 120 # en unidades de 0.1 seg.
-keepalive_cnt = 0
+keepalive_ref = 0
+
+# Periodo máximo de espera por actividad en las conexiones (mseg.) :
+POLL_PERIOD = 100
+
+# Mensajes de depuración de cada mensaje re-dirigido (IR_DEBUG en secrets), deshabilitados por
+# omisión : la consola (UART a 115200 baudios) demora el proceso unos 87 uSeg. por carácter.
+# Los errores se informan siempre :
+IR_DEBUG = globals().get('IR_DEBUG', False)
 
 # Intervalos de espera para reintentar la conexión con el router. Debe terminar en 0 pues no tiene
 # caso esperar después del último (re-)intento, define implícitamente el número de reintentos (ie.
@@ -32,9 +126,107 @@ password = WIFI_PSW
 broker_ip = MQTT_BROKER
 port = MQTT_PORT
 
-# ID del cliente y tópico al que se suscribe :
+# ID del cliente y tópicos : los del equipo cuelgan de ir_proxy/<sitio>/<cuarto>/<equipo>
+# (IR_SITE, IR_ROOM e IR_DEVICE en secrets), los mensajes se reciben en <topic>/cmd y el
+# estado se publica (retenido, y como última voluntad al perder la conexión) en 
+# <topic>/status (y el estado de salud en <topic>/health). Además se reciben los mensajes de los grupos del sitio a los que pertenece
+# el equipo (IR_GROUPS), publicados en ir_proxy/<sitio>/group/<grupo>/cmd, de manera que
+# varios equipos de un mismo broker solo reciben sus mensajes :
 client_id_header = 'IR_PROXY_uPython_'
-topic = b'ir_proxy/deco_tv'
+TOPIC_ROOT = b'ir_proxy/'
+site = globals().get('IR_SITE', 'casa').encode()
+topic = TOPIC_ROOT + site + b'/' + globals().get('IR_ROOM', 'sala').encode() + b'/' \
+        + globals().get('IR_DEVICE', 'deco_tv').encode()
+cmd_topic = topic + b'/cmd'
+status_topic = topic + b'/status'
+health_topic = topic + b'/health'
+group_topics = [TOPIC_ROOT + site + b'/group/' + g.encode() + b'/cmd'
+                for g in globals().get('IR_GROUPS', ())]
+
+# Zonas (emisores del microcontrolador) : {nombre : máscara de salidas}, definidas en 
+# secrets (IR_ZONES). Los mensajes del tópico <topic>/zone/<nombre> se dirigen a las salidas
+# de la zona, los demás (y los recibidos por UDP) a la salida por omisión :
+zones = globals().get('IR_ZONES', {})
+ZONE_SUBTOPIC = b'/zone/'
+zone_prefix = topic + ZONE_SUBTOPIC
+
+# Recepción directa por UDP (opcional, solo si se define UDP_KEY en secrets). Cada datagrama
+# contiene [Secuencia (6 bytes)] [MAC (8 bytes)] [Mensaje binario], donde la secuencia (big-
+# endian) debe ser creciente y el MAC son los primeros bytes del HMAC-SHA256 de la secuencia
+# y el mensaje con la clave compartida. La secuencia es el instante de envío (mseg. Unix),
+# por lo que tras un reinicio solo se aceptan las que distan menos de UDP_SEQ_WINDOW_MS del
+# reloj (sin el reloj sincronizado se rechazan todas, y el cliente recurre al broker), de
+# manera que un datagrama capturado no puede re-enviarse más tarde. Los mensajes aceptados
+# se confirman devolviendo [UDP_ACK] [Secuencia] antes de re-dirigirlos, para que el
+# cliente no lo publique además en el broker si la re-dirección demora :
+udp_port = globals().get('UDP_PORT', 4210)
+udp_key = globals().get('UDP_KEY')
+UDP_SEQ_SIZE = 6
+UDP_MAC_SIZE = 8
+UDP_HEADER_SIZE = UDP_SEQ_SIZE + UDP_MAC_SIZE
+UDP_MAX_SIZE = 512
+UDP_ACK = b'\x06'
+UDP_SEQ_WINDOW_MS = 30000
+udp_sock = None
+udp_last_seq = bytes(UDP_SEQ_SIZE)
+
+# Conexión con el broker, para publicar los patrones aprendidos :
+mqtt_client = None
+
+# Mensajes con vigencia : [STAMP_ID] [Instante de envío] [Vigencia] [Mensaje], el instante
+# (en mseg. desde 1970, UTC) y la vigencia (mseg.) son números VLQ. Se descartan los
+# mensajes vencidos (e.g. los acumulados en el broker o en el cliente durante una 
+# desconexión), los repetidos (e.g. el mismo mensaje por UDP y, si no se confirmó a tiempo,
+# por el broker, entre los últimos STAMP_RECENT aceptados) y los que llegan fuera de orden
+# por más de STAMP_REORDER_MS (la tolerancia admite varios clientes con relojes levemente
+# desfasados). Para ello el reloj se sincroniza por NTP (cada CLOCK_RESYNC_MS, pues
+# ticks_ms() da la vuelta), y se descartan los mensajes con el instante de envío más de
+# STAMP_SKEW_MS en el futuro, que de otra manera bloquearían los siguientes. Sin sincronía
+# solo se descartan los repetidos :
+STAMP_ID         = 0x7C
+STAMP_SKEW_MS    = 2000
+STAMP_REORDER_MS = 1000
+STAMP_RECENT     = 8
+EPOCH_OFFSET     = 946684800    # Inicio de la época de MicroPython (2000) en tiempo Unix.
+CLOCK_RESYNC_MS  = 3600000
+clock_ref = None
+last_stamp = 0
+recent_stamped = []
+stats = {'expired' : 0, 'reordered' : 0, 'duplicated' : 0, 'future' : 0, 'late' : 0, 'preempted' : 0, 'lane_full' : 0,
+         'relayed' : 0, 'rejected' : 0, 'spi_bytes' : 0, 'wifi' : 0, 'mqtt' : 0, 'reports' : 0}
+
+# Estado de salud : cada HEALTH_PERIOD_MS (en secrets, por omisión un minuto) se publica,
+# retenido, en <topic>/health un resumen en JSON : los contadores de stats (conexiones Wifi
+# y MQTT, mensajes re-dirigidos y rechazados, bytes escritos en el SPI, ...), la memoria
+# libre y ocupada tras la recolección, la intensidad de la señal Wifi (dBm) y el tiempo
+# máximo y medio (uSeg.) del proceso de los mensajes recibidos en el periodo. 'reports'
+# numera los resúmenes publicados desde el arranque (un salto delata uno perdido). Para no
+# demorar la emisión se publica con el microcontrolador en reposo, salvo que se haya
+# postergado por un periodo completo :
+HEALTH_PERIOD_MS = globals().get('HEALTH_PERIOD_MS', 60000)
+health_ref = 0
+relay_us = [0, 0, 0]    # Máximo, total y número de mensajes del periodo.
+
+# El reloj se sincroniza por SNTP con NTP_HOST (en secrets, por omisión el broker, e.g. con
+# chrony), con la resolución del mseg. y compensando la mitad del tiempo de ida y vuelta.
+# Si no responde se recurre a ntptime, con la resolución del segundo :
+NTP_HOST         = globals().get('NTP_HOST', MQTT_BROKER)
+NTP_PORT         = globals().get('NTP_PORT', 123)
+NTP_DELTA        = 2208988800   # Inicio de la época de NTP (1900) en tiempo Unix (negativo).
+SNTP_TIMEOUT_MS  = 500
+
+# Emisión programada : [AT_ID] [Instante] [Mensaje], el instante en mseg. desde 1970 (UTC).
+# El mensaje se retiene hasta AT_LEAD_MS antes del instante, y los patrones se envían con
+# la demora restante (PATTERN_OPT_DELAY) que el microcontrolador cuenta con la portadora;
+# los demás mensajes se re-dirigen en el instante. Como los urgentes, los patrones
+# programados no esperan en el carril normal (cancelan las repeticiones acumuladas), y este
+# se detiene si su siguiente envío demoraría al microcontrolador más allá del instante
+# (schedule_hold()). Los que llegan tarde (o sin el reloj sincronizado) se re-dirigen de
+# inmediato, y los programados a más de AT_MAX_MS se descartan :
+AT_ID            = 0x78
+AT_LEAD_MS       = 30
+AT_MAX_MS        = 60000
+scheduled = []
 
 # Se definen las líneas de control de los LEDs:
 led_broker_OK = Pin(5, Pin.OUT)
@@ -52,6 +244,12 @@ led_wifi_OK.on()
 hspi = SPI(1, baudrate=1000000, polarity=0, phase=0)
 data = bytearray(50)
 
+# Escribe el mensaje 'data' en el SPI (hacia el microcontrolador) :
+def spi_write(data) :
+  hspi.write(data)
+  stats['spi_bytes'] += len(data)
+
+
 def show_APs() :
   for n, ap in enumerate(network.WLAN(network.STA_IF).scan()) :
     print(' {:d}: {:s} [{:d}dbm] CH{:2d} {:12s} {:s}'.format(n, ap[0], ap[3], ap[2],
@@ -105,44 +303,809 @@ def wifi_connect() :
   return True
 
   
-# Función de callback para el proceso de los mensajes al tópico suscrito. Decodifica el mensaje
-# para convertirlo en la secuencia de bytes que representa.
-def relay_code(topic, code_str) :
-  global keepalive_cnt, broker_cnt
+# Devuelve el número VLQ que inicia en data[idx] y el índice del siguiente :
+def read_number(data, idx) :
+  num = 0
+  shift = 0
+  while True :
+    b = data[idx]
+    idx += 1
+    num |= (b & 0x7F) << shift
+    shift += 7
+    if not (b & 0x80) :
+      return num, idx
+
+
+# Devuelve la duración (en mseg.) de la emisión del patrón 'frame' en el microcontrolador,
+# o el tiempo de espera sin actividad (CLEARANCE_MS) si el microcontrolador lo rechazará
+# (más de IR_CODE_SIZE bytes o números de más de 2 bytes) :
+def pattern_duration_ms(frame) :
+  protocol, idx = read_number(frame, 0)
+  if protocol != INFRARED_REMOTE_PROXY_PROTOCOL and protocol != INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    return 0
+  if len(frame) > IR_CODE_SIZE :
+    return CLEARANCE_MS
+
+  num_pulses, idx = read_number(frame, idx)
+  options = 0
+  if protocol == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    options, idx = read_number(frame, idx)
+  period, idx = read_number(frame, idx)
+  duty_cycle, idx = read_number(frame, idx)
+  time_base = 1
+  delay = 0
+  for bit in range(7) :
+    if options & (1 << bit) :
+      value, idx = read_number(frame, idx)
+      if (1 << bit) == PATTERN_OPT_TIME_BASE and 0 < value <= 0xFF :
+        time_base = value
+      elif (1 << bit) == PATTERN_OPT_DELAY :
+        delay = value
+  cycles = delay
+  for n in range(2*num_pulses) :
+    c, idx = read_number(frame, idx)
+    cycles += c
+    if c >= MAX_NUMBER :
+      return CLEARANCE_MS
+  if period >= MAX_NUMBER or duty_cycle >= MAX_NUMBER :
+    return CLEARANCE_MS
+
+  return (cycles * time_base * period) // (FOSC // 1000) + 1
+
+
+# Devuelve el código VLQ del número 'num' :
+def encode_number(num) :
+  code = bytearray()
+  while num > 127 :
+    code.append(0x80 | (num & 0x7F))
+    num >>= 7
+  code.append(num)
+  return code
+
+
+# Devuelve el patrón 'frame' (versión 1 o 2) con la opción 'opt' de valor 'value', i.e. en
+# la versión 2 (los valores de las opciones siguen el orden de sus bits). Los demás mensajes
+# se devuelven sin cambios :
+def add_option(frame, opt, value) :
+  protocol, idx = read_number(frame, 0)
+  if protocol != INFRARED_REMOTE_PROXY_PROTOCOL and protocol != INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    return frame
+
+  num_pulses, idx = read_number(frame, idx)
+  head = idx
+  options = 0
+  if protocol == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    options, idx = read_number(frame, idx)
+  carrier = idx
+  period, idx = read_number(frame, idx)
+  duty_cycle, idx = read_number(frame, idx)
+  carrier_end = idx
+  values = {}
+  for bit in range(7) :
+    if options & (1 << bit) :
+      values[1 << bit], idx = read_number(frame, idx)
+  values[opt] = value
+
+  routed = bytearray((INFRARED_REMOTE_PROXY_PROTOCOL_2,)) + frame[1:head]
+  routed += encode_number(options | opt) + frame[carrier:carrier_end]
+  for bit in sorted(values) :
+    routed += encode_number(values[bit])
+  return routed + frame[idx:]
+
+
+# Devuelve el patrón 'frame' dirigido a las salidas 'outputs' (PATTERN_OPT_OUTPUTS) :
+def route(frame, outputs) :
+  return add_option(frame, PATTERN_OPT_OUTPUTS, outputs)
+
+
+# Devuelve el patrón 'frame' con la demora 'delay_ms' (PATTERN_OPT_DELAY), en las unidades
+# de la duración de sus pulsos (periodo de la portadora por la base de tiempo) :
+def delay_pattern(frame, delay_ms) :
+  protocol, idx = read_number(frame, 0)
+  num_pulses, idx = read_number(frame, idx)
+  options = 0
+  if protocol == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    options, idx = read_number(frame, idx)
+  period, idx = read_number(frame, idx)
+  duty_cycle, idx = read_number(frame, idx)
+  time_base = 1
+  if options & PATTERN_OPT_TIME_BASE :
+    time_base, idx = read_number(frame, idx)
+  units = (delay_ms * (FOSC // 1000)) // (period * time_base)
+  if units <= 0 :
+    return frame
+  return add_option(frame, PATTERN_OPT_DELAY, min(units, MAX_NUMBER - 1))
+
+
+# Reproduce la secuencia de teclas (macro) con la temporización local, el formato es :
+#   [MACRO_ID] [Número de pasos] ([Espera] [Longitud del patrón] [Patrón]) ...
+# La espera (mseg.) se mide desde el fin de la emisión del patrón anterior, la longitud 0
+# indica que el patrón es el mismo del paso cuyo índice sigue. La secuencia se valida por
+# completo antes de encolar sus pasos en el carril normal (lane_task() los reproduce), y sus
+# patrones se dirigen a las salidas 'outputs' (si no es None) :
+def play_macro(data, outputs=None) :
+  num_steps, idx = read_number(data, 1)
+  steps = []
+  for n in range(num_steps) :
+    gap, idx = read_number(data, idx)
+    size, idx = read_number(data, idx)
+    if size == 0 :
+      ref, idx = read_number(data, idx)
+      frame = steps[ref][1]
+    else :
+      frame = data[idx:idx+size]
+      idx += size
+      if len(frame) != size :
+        raise ValueError('Patrón incompleto en el paso {:d}'.format(n))
+      if outputs is not None :
+        frame = route(frame, outputs)
+    steps.append((gap, frame, utime.ticks_ms()))
+
+  if idx != len(data) :
+    raise ValueError('La macro contiene bytes sobrantes')
+  if len(steps) > LANE_MAX :
+    raise ValueError('La macro no cabe en el carril ({:d} pasos)'.format(len(steps)))
+
+  lane_wait(len(steps))
+  lane.extend(steps)
+
+
+# Espera que el microcontrolador termine la emisión en curso (estimada) :
+def wait_pic() :
+  busy_ms = utime.ticks_diff(last_end, utime.ticks_ms())
+  if busy_ms > 0 :
+    utime.sleep_ms(busy_ms)
+
+
+# Espera que el microcontrolador tenga un banco libre para recibir un patrón, i.e. que
+# inicie la emisión del último enviado, y devuelve el inicio estimado de la emisión del
+# siguiente :
+def wait_bank() :
+  busy_ms = utime.ticks_diff(last_start, utime.ticks_ms())
+  if busy_ms > 0 :
+    utime.sleep_ms(busy_ms)
+  now = utime.ticks_ms()
+  return last_end if utime.ticks_diff(last_end, now) > 0 else now
+
+
+def frame_check(frame) :
+  return sum(frame) & 0x7F
+
+
+# Envía las repeticiones acumuladas del último patrón :
+def repeat_flush() :
+  global last_start, last_end, rcve_free, repeat_series, repeat_pending
+
+  if repeat_pending :
+    start = wait_bank()
+    repeat_msg[1] = repeat_pending
+    repeat_msg[2] = frame_check(last_frame)
+    spi_write(repeat_msg)
+    duration = pattern_duration_ms(last_frame)
+    repeat_series = (start, duration, repeat_pending)
+    rcve_free = start
+    last_start = utime.ticks_add(start, (repeat_pending - 1) * duration)
+    last_end = utime.ticks_add(start, repeat_pending * duration + MACRO_GUARD_MS)
+    repeat_pending = 0
+
+
+# Devuelve la prioridad (PATTERN_OPT_PRIORITY) del patrón 'frame', 0 si no la indica :
+def pattern_priority(frame) :
+  protocol, idx = read_number(frame, 0)
+  if protocol != INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    return 0
+
+  num_pulses, idx = read_number(frame, idx)
+  options, idx = read_number(frame, idx)
+  if not (options & PATTERN_OPT_PRIORITY) :
+    return 0
+  period, idx = read_number(frame, idx)
+  duty_cycle, idx = read_number(frame, idx)
+  for bit in range(7) :
+    if options & (1 << bit) :
+      value, idx = read_number(frame, idx)
+      if (1 << bit) == PATTERN_OPT_PRIORITY :
+        return value
+
+
+# Envía el patrón 'data' sin esperar, su emisión inicia al terminar la emisión en curso o,
+# si es urgente, la repetición en curso :
+def write_pattern(data, urgent=False) :
+  global last_frame, last_start, last_end, rcve_free, repeat_series
+
+  now = utime.ticks_ms()
+  start = last_end if utime.ticks_diff(last_end, now) > 0 else now
+  if urgent and repeat_series and utime.ticks_diff(start, now) > 0 :
+    series_start, duration, times = repeat_series
+    done = max(1, utime.ticks_diff(now, series_start) // duration + 1)
+    if done < times :
+      start = utime.ticks_add(series_start, done * duration)
+
+  spi_write(data)
+  last_frame = bytes(data)
+  rcve_free = last_start = start
+  last_end = utime.ticks_add(start, pattern_duration_ms(data) + MACRO_GUARD_MS)
+  repeat_series = None
+
+
+# Envía el patrón urgente 'data' en cuanto el microcontrolador puede recibirlo, antes que
+# los mensajes del carril normal, y cancela las repeticiones acumuladas :
+def send_urgent(data) :
+  global repeat_pending
+
+  if repeat_pending :
+    stats['preempted'] += repeat_pending
+    repeat_pending = 0
+  busy_ms = utime.ticks_diff(rcve_free, utime.ticks_ms())
+  if busy_ms > 0 :
+    utime.sleep_ms(busy_ms)
+  write_pattern(data, True)
+
+
+# Envía al microcontrolador los mensajes del carril normal, tras las repeticiones 
+# acumuladas, en cuanto tiene un banco libre (los pasos de las macros además tras su 
+# espera), devuelve la espera (mseg.) hasta el siguiente, a lo más POLL_PERIOD :
+def lane_task() :
+  global last_frame
+
+  while lane :
+    if repeat_pending :
+      ready = last_start
+    else :
+      gap, frame, queued = lane[0]
+      ready = last_start
+      if gap is not None :
+        ready = last_end if utime.ticks_diff(last_end, queued) > 0 else queued
+        ready = utime.ticks_add(ready, gap)
+
+    wait_ms = utime.ticks_diff(ready, utime.ticks_ms())
+    if wait_ms > 0 :
+      return min(POLL_PERIOD, wait_ms)
+    wait_ms = schedule_hold(pattern_duration_ms(last_frame) * repeat_pending if repeat_pending
+                            else pattern_duration_ms(frame))
+    if wait_ms > 0 :
+      return min(POLL_PERIOD, wait_ms)
+
+    if repeat_pending :
+      repeat_flush()
+    else :
+      lane.pop(0)
+      write_pattern(frame)
+      if gap is not None :
+        last_frame = None
+  return POLL_PERIOD
+
+
+# Envía todos los mensajes del carril normal y las repeticiones acumuladas (antes de los
+# mensajes que requieren el microcontrolador en reposo), y los programados que venzan :
+def lane_flush() :
+  while lane :
+    utime.sleep_ms(min(schedule_task(), lane_task()))
+  repeat_flush()
+
+
+# Espera que el carril normal tenga lugar para 'count' mensajes, i.e. con el carril lleno
+# se dejan de recibir mensajes (como antes de los carriles) :
+def lane_wait(count) :
+  if len(lane) + count > LANE_MAX :
+    stats['lane_full'] += 1
+  while len(lane) + count > LANE_MAX :
+    utime.sleep_ms(min(schedule_task(), lane_task()))
+
+
+# Envía el patrón 'data' al microcontrolador, o su repetición si es el último enviado :
+def send_pattern(data) :
+  global repeat_pending
+
+  if pattern_priority(data) :
+    send_urgent(data)
+    return
+
+  now = utime.ticks_ms()
+  if not lane and data == last_frame and utime.ticks_diff(now, last_end) < REPEAT_WINDOW_MS :
+    repeat_pending += 1
+    if (repeat_pending >= REPEAT_MAX or utime.ticks_diff(now, last_end) >= 0) and \
+       not schedule_hold(pattern_duration_ms(data) * repeat_pending) :
+      repeat_flush()
+    return
+
+  lane_wait(1)
+  lane.append((None, data, utime.ticks_ms()))
+  lane_task()
+
+
+# Devuelve el instante (mseg. Unix) y el valor de ticks_ms() correspondientes, consultados
+# por SNTP al servidor 'host' :
+def sntp_ms(host) :
+  request = bytearray(48)
+  request[0] = 0x1B     # LI = 0, Versión 3, Modo 3 (cliente).
+  sock = usocket.socket(usocket.AF_INET, usocket.SOCK_DGRAM)
+  try :
+    sock.settimeout(SNTP_TIMEOUT_MS / 1000)
+    sent = utime.ticks_ms()
+    sock.sendto(request, usocket.getaddrinfo(host, NTP_PORT)[0][-1])
+    reply = sock.recv(48)
+    received = utime.ticks_ms()
+  finally :
+    sock.close()
+
+  # Instante de transmisión de la respuesta (segundos y fracción de 32 bits) :
+  seconds = int.from_bytes(reply[40:44], 'big') - NTP_DELTA
+  fraction = int.from_bytes(reply[44:48], 'big')
+  rtt = utime.ticks_diff(received, sent)
+  return seconds * 1000 + ((fraction * 1000) >> 32) + rtt // 2, received
+
+
+# Sincroniza el reloj, guarda el instante (mseg. Unix) y el valor de ticks_ms()
+# correspondientes :
+def sync_clock() :
+  global clock_ref
+  try :
+    clock_ref = sntp_ms(NTP_HOST)
+    return
+  except Exception as e :
+    print('No se pudo sincronizar el reloj por SNTP : {!r}'.format(e))
+  try :
+    ntptime.settime()
+    clock_ref = ((utime.time() + EPOCH_OFFSET) * 1000, utime.ticks_ms())
+  except Exception as e :
+    print('No se pudo sincronizar el reloj : {!r}'.format(e))
+
+
+# Devuelve el instante actual (mseg. Unix) o None si el reloj no esta sincronizado :
+def now_ms() :
+  if clock_ref is None :
+    return None
+  return clock_ref[0] + utime.ticks_diff(utime.ticks_ms(), clock_ref[1])
+
+
+# Programa el mensaje 'data' (AT_ID) dirigido a las salidas 'outputs', devuelve el mensaje
+# contenido y su instante si debe re-dirigirse de inmediato (el instante es None si ya
+# pasó), None si se programó o False si se descarta :
+def schedule(data, outputs) :
+  at, idx = read_number(data, 1)
+  data = data[idx:]
+  now = now_ms()
+  if now is None :
+    return data, None
+  if at - now > AT_MAX_MS :
+    print('Mensaje programado dentro de {:d} mseg., se descarta.'.format(at - now))
+    return False
+  if at - now > AT_LEAD_MS :
+    n = 0
+    while n < len(scheduled) and scheduled[n][0] <= at :
+      n += 1
+    scheduled.insert(n, (at, data, outputs))
+    return None
+  if at <= now :
+    stats['late'] += 1
+    print('Mensaje programado recibido {:d} mseg. tarde.'.format(now - at))
+    return data, None
+  return data, at
+
+
+# Re-dirige los mensajes programados cuyo instante esta a menos de AT_LEAD_MS (con el
+# registro de relay()), devuelve la espera (mseg.) hasta el siguiente, a lo más
+# POLL_PERIOD :
+def schedule_task() :
+  while scheduled :
+    wait_ms = scheduled[0][0] - AT_LEAD_MS - now_ms()
+    if wait_ms > 0 :
+      return min(POLL_PERIOD, wait_ms)
+    at, data, outputs = scheduled.pop(0)
+    relay(data, outputs, at)
+  return POLL_PERIOD
+
 
-  def print_msg(msg) : print('Mensaje recibido : {:s}'.format(code_str))
+# Devuelve la espera (mseg.) del envío de 'duration_ms' de emisión al microcontrolador, 0 si
+# termina (tras la emisión en curso) antes de AT_LEAD_MS del siguiente mensaje programado,
+# o hasta que este se re-dirija :
+def schedule_hold(duration_ms) :
+  if not scheduled or clock_ref is None :
+    return 0
+  lead_ms = scheduled[0][0] - AT_LEAD_MS - now_ms()
+  busy_ms = max(0, utime.ticks_diff(last_end, utime.ticks_ms()))
+  if busy_ms + duration_ms + MACRO_GUARD_MS <= lead_ms :
+    return 0
+  return max(1, lead_ms)
 
-  if len(code_str) % 2 == 0 :
+
+# Envía el patrón 'data' con la demora que inicia su emisión en el instante 'at', sin
+# esperar los mensajes del carril normal; cancela las repeticiones acumuladas :
+def send_at(data, at) :
+  global last_frame, repeat_pending
+
+  if repeat_pending :
+    stats['preempted'] += repeat_pending
+    repeat_pending = 0
+  wait_pic()
+  delay_ms = at - now_ms()
+  if delay_ms <= 0 :
+    stats['late'] += 1
+  else :
+    data = delay_pattern(data, delay_ms)
+  write_pattern(data)
+  last_frame = None
+
+
+# Verifica la vigencia del mensaje 'data' (STAMP_ID), devuelve el mensaje contenido o None
+# si debe descartarse :
+def unstamp(data) :
+  global last_stamp
+
+  stamp, idx = read_number(data, 1)
+  ttl, idx = read_number(data, idx)
+  if data in recent_stamped :
+    stats['duplicated'] += 1
+    print('Mensaje repetido, se descarta ({:d} descartados).'.format(stats['duplicated']))
+    return None
+
+  now = now_ms()
+  if now is not None :
+    if stamp - now > STAMP_SKEW_MS :
+      stats['future'] += 1
+      print('Mensaje enviado {:d} mseg. en el futuro, se descarta.'.format(stamp - now))
+      return None
+    if now - stamp > ttl :
+      stats['expired'] += 1
+      print('Mensaje vencido hace {:d} mseg., se descarta ({:d} descartados).'.format(
+            now - stamp - ttl, stats['expired']))
+      return None
+    if last_stamp - stamp > STAMP_REORDER_MS :
+      stats['reordered'] += 1
+      print('Mensaje fuera de orden, se descarta ({:d} descartados).'.format(stats['reordered']))
+      return None
+    last_stamp = max(last_stamp, stamp)
+
+  recent_stamped.append(bytes(data))
+  if len(recent_stamped) > STAMP_RECENT :
+    recent_stamped.pop(0)
+  return data[idx:]
+
+
+# Lee del microcontrolador el siguiente byte de SPIDump() :
+def dump_byte() :
+  utime.sleep_us(SPI_DUMP_GAP_US)
+  return hspi.read(1)[0]
+
+
+# Lee del microcontrolador un número VLQ, que se agrega al patrón 'frame' :
+def learn_number(frame) :
+  num = 0
+  shift = 0
+  while True :
+    b = dump_byte()
+    frame.append(b)
+    num |= (b & 0x7F) << shift
+    shift += 7
+    if not (b & 0x80) :
+      return num
+
+
+# Espera que el microcontrolador devuelva el byte de sincronía 'sync', hasta 'wait_ms' :
+def read_sync(sync, wait_ms) :
+  # El primer byte leído es el último de la solicitud (todavía en el registro del SPI) :
+  hspi.read(1)
+  start = utime.ticks_ms()
+  while hspi.read(1)[0] != sync :
+    if utime.ticks_diff(utime.ticks_ms(), start) >= wait_ms :
+      return False
+    utime.sleep_ms(LEARN_POLL_MS)
+
+  return True
+
+
+# Envía la solicitud del registro de eventos 'data' y lo devuelve (su primer byte es la
+# longitud total), o None si no se recibe :
+def trace_dump(data) :
+  global last_frame
+
+  lane_flush()
+  wait_pic()
+  last_frame = None
+  spi_write(data)
+  if not read_sync(TRACE_SYNC, TRACE_WAIT_MS) :
+    return None
+
+  dump = bytearray((dump_byte(),))
+  for n in range(dump[0] - 1) :
+    dump.append(dump_byte())
+  return dump
+
+
+# Envía la solicitud de aprendizaje 'data' y devuelve el patrón capturado por el
+# microcontrolador, o None si no se recibe en LEARN_WAIT_MS :
+def learn_pattern(data) :
+  global last_frame
+
+  lane_flush()
+  wait_pic()
+  last_frame = None
+  spi_write(data)
+
+  if not read_sync(LEARN_SYNC, LEARN_WAIT_MS) :
+    return None
+
+  frame = bytearray()
+  learn_number(frame)
+  num_pulses = learn_number(frame)
+  for n in range(2 + 2*num_pulses) :
+    learn_number(frame)
+
+  return frame
+
+
+# Re-dirige el mensaje binario 'data' (recibido por MQTT o UDP) al microcontrolador, o lo
+# reproduce si se trata de una macro o publica el patrón aprendido (o el registro de 
+# eventos) si es una solicitud de aprendizaje (o del registro). Los mensajes con vigencia
+# (STAMP_ID) se verifican y se desenvuelven antes, y los programados (AT_ID) se retienen
+# hasta su instante 'at'. Los patrones se dirigen a las salidas 'outputs' (zona), si no es
+# None. Devuelve True si el mensaje fue aceptado, o None si se retuvo (programado) :
+def relay_frame(data, outputs=None, at=None) :
+  global keepalive_ref, broker_cnt
+
+  if data and data[0] == STAMP_ID :
     try :
-      print('decoding ...')
-      data = bytearray(int(chr(h1)+chr(h2), 16) for h1,h2 in zip(*[iter(code_str)]*2))
-    except Exception as e :
-      print('El mensaje recibido contiene caracteres diferentes de las cifras hexadecimales.')
-      print_msg(code_str)
-      print('Excepción : {!r}'.format(e))
-      return
+      data = unstamp(data)
+    except IndexError :
+      print('El mensaje con vigencia no tiene el formato correcto.')
+      return False
+    if data is None :
+      return False
 
-    print('Re-dirigiendo el mensaje al puerto SPI.')
-    print_msg(code_str)
-    print('packed_data : {!r}'.format(data))
-    hspi.write(data)
+  if data and data[0] == AT_ID :
+    try :
+      relayed = schedule(data, outputs)
+    except IndexError :
+      print('El mensaje programado no tiene el formato correcto.')
+      return False
+    if not relayed :
+      return relayed
+    data, at = relayed
+
+  is_pattern = data and (data[0] == INFRARED_REMOTE_PROXY_PROTOCOL or data[0] == INFRARED_REMOTE_PROXY_PROTOCOL_2)
+  if at is not None and not is_pattern :
+    # Los demás mensajes programados se re-dirigen en el instante indicado :
+    wait_ms = at - now_ms()
+    if wait_ms > 0 :
+      utime.sleep_ms(wait_ms)
+
+  if data and data[0] == MACRO_ID :
+    if IR_DEBUG :
+      print('Encolando la macro.')
+    try :
+      play_macro(data, outputs)
+    except (IndexError, ValueError) as e :
+      print('La macro recibida no tiene el formato correcto : {!r}'.format(e))
+      return False
+  elif data and data[0] == LEARN_ID :
+    try :
+      period = read_number(data, 2)[0]
+    except IndexError :
+      period = 0
+    if period < LEARN_MIN_PERIOD :
+      print('La solicitud de aprendizaje no tiene un periodo válido.')
+      return False
+    print('Esperando el patrón a aprender.')
+    frame = learn_pattern(data)
+    if frame is None :
+      print('No se recibió el patrón aprendido.')
+      return False
+    code = ''.join('{:02X}'.format(b) for b in frame)
+    print('Patrón aprendido : {}'.format(code))
+    if mqtt_client :
+      mqtt_client.publish(topic + b'/learned', code)
+  elif data and data[0] == TRACE_ID :
+    print('Leyendo el registro de eventos.')
+    dump = trace_dump(data)
+    if dump is None :
+      print('No se recibió el registro de eventos.')
+      return False
+    if mqtt_client :
+      mqtt_client.publish(topic + b'/trace', ''.join('{:02X}'.format(b) for b in dump))
+  elif is_pattern :
+    if outputs is not None :
+      try :
+        data = route(data, outputs)
+      except IndexError :
+        print('El patrón recibido no tiene el formato correcto.')
+        return False
+    if IR_DEBUG :
+      print('Re-dirigiendo el patrón al puerto SPI.')
+      print('packed_data : {!r}'.format(data))
+    if at is not None :
+      try :
+        send_at(data, at)
+      except IndexError :
+        print('El patrón recibido no tiene el formato correcto.')
+        return False
+    else :
+      try :
+        send_pattern(data)
+      except IndexError :
+        print('El patrón recibido no tiene el formato correcto.')
+        return False
+  else :
+    if IR_DEBUG :
+      print('Re-dirigiendo el mensaje al puerto SPI.')
+      print('packed_data : {!r}'.format(data))
+    spi_write(data)
+  if IR_DEBUG :
     print('Done\n\n')
-    
-    # Se señaliza la recepción (como consecuencia se apaga el LED del broker brevemente) :
-    broker_cnt = 1
-    
-    # Finalmente se reinicia el periodo de espera del guardián :
-    keepalive_cnt = 0
+
+  # Se señaliza la recepción (como consecuencia se apaga el LED del broker brevemente) :
+  broker_cnt = 1
+
+  # Finalmente se reinicia el periodo de espera del guardián :
+  keepalive_ref = utime.ticks_ms()
+
+  return True
+
+
+# Re-dirige el mensaje (relay_frame()) y registra el resultado y el tiempo de su proceso
+# para el estado de salud; los mensajes programados se registran al re-dirigirse en su
+# instante (schedule_task()) :
+def relay(data, outputs=None, at=None) :
+  start = utime.ticks_us()
+  relayed = relay_frame(data, outputs, at)
+  elapsed = utime.ticks_diff(utime.ticks_us(), start)
+
+  if relayed is not None :
+    stats['relayed' if relayed else 'rejected'] += 1
+  relay_us[0] = max(relay_us[0], elapsed)
+  relay_us[1] += elapsed
+  relay_us[2] += 1
+  return relayed
+
+
+# Los mensajes (hexadecimal) se decodifican con ubinascii.unhexlify(), implementada en C,
+# en lugar de procesar cada cifra con el intérprete. La longitud se valida antes, de a lo
+# más FRAME_MAX bytes (el mayor datagrama UDP) :
+FRAME_MAX = UDP_MAX_SIZE
+
+
+# Devuelve el mensaje 'code_str' (cifras hexadecimales) como bytearray, o None si no tiene
+# una longitud par, excede FRAME_MAX bytes o contiene otros caracteres :
+def decode_code(code_str) :
+  n = len(code_str)
+  if n & 1 or n > 2*FRAME_MAX :
+    return None
+  try :
+    return bytearray(ubinascii.unhexlify(code_str))
+  except ValueError :
+    return None
+
+
+# Función de callback para el proceso de los mensajes al tópico suscrito. Decodifica el mensaje
+# para convertirlo en la secuencia de bytes que representa. La zona se identifica por el
+# tópico (msg_topic) en que se recibe.
+def relay_code(msg_topic, code_str) :
+
+  def print_msg(msg) : print('Mensaje recibido : {}'.format(code_str))
+
+  data = decode_code(code_str)
+  if data is not None :
+    if IR_DEBUG :
+      print_msg(code_str)
+    outputs = None
+    if msg_topic.startswith(zone_prefix) :
+      outputs = zones.get(msg_topic[len(zone_prefix):].decode())
+      if outputs is None :
+        print('Zona desconocida : {}'.format(msg_topic))
+        stats['rejected'] += 1
+        return
+    relay(data, outputs)
 
   else :
-    # El mensaje no tiene la longitud correcta :
-    print('El mensaje recibido no tiene una longitud par.\n')
+    # El mensaje no tiene la longitud correcta o contiene otros caracteres :
+    print('El mensaje recibido no tiene una longitud par (de a lo más {:d} bytes)'.format(FRAME_MAX))
+    print('o contiene caracteres diferentes de las cifras hexadecimales.\n')
     print_msg(code_str)
+    stats['rejected'] += 1
 
     
+# Prepara los bloques de la clave del HMAC-SHA256 (inner y outer pad) :
+def mac_pads(key) :
+  if isinstance(key, str) :
+    key = key.encode()
+  if len(key) > 64 :
+    key = uhashlib.sha256(key).digest()
+  key = key + bytes(64 - len(key))
+  return bytes(b ^ 0x36 for b in key), bytes(b ^ 0x5C for b in key)
+
+
+# Devuelve el MAC (HMAC-SHA256 truncado) del mensaje 'msg' :
+def mac(pads, msg) :
+  inner = uhashlib.sha256(pads[0])
+  inner.update(msg)
+  outer = uhashlib.sha256(pads[1])
+  outer.update(inner.digest())
+  return outer.digest()[:UDP_MAC_SIZE]
+
+
+# Abre el socket UDP para la recepción directa, si esta habilitada :
+def udp_open() :
+  global udp_sock, udp_pads
+  if udp_key is None :
+    return None
+
+  if udp_sock is None :
+    udp_pads = mac_pads(udp_key)
+    udp_sock = usocket.socket(usocket.AF_INET, usocket.SOCK_DGRAM)
+    udp_sock.setsockopt(usocket.SOL_SOCKET, usocket.SO_REUSEADDR, 1)
+    udp_sock.bind(usocket.getaddrinfo('0.0.0.0', udp_port)[0][-1])
+    udp_sock.setblocking(False)
+    print('Recepción UDP en el puerto {:d}'.format(udp_port))
+
+  return udp_sock
+
+
+# Procesa los datagramas pendientes, se descartan los que no estén autenticados o cuya
+# secuencia no sea mayor que la del último aceptado (repetidos, desordenados o re-enviados) :
+def udp_task(sock) :
+  global udp_last_seq
+
+  while True :
+    try :
+      packet, addr = sock.recvfrom(UDP_MAX_SIZE)
+    except OSError :
+      return
+
+    if len(packet) <= UDP_HEADER_SIZE :
+      print('Datagrama UDP demasiado corto.')
+      continue
+
+    seq = packet[:UDP_SEQ_SIZE]
+    data = packet[UDP_HEADER_SIZE:]
+    if mac(udp_pads, seq + data) != packet[UDP_SEQ_SIZE:UDP_HEADER_SIZE] :
+      print('Datagrama UDP no autenticado.')
+      continue
+
+    if seq <= udp_last_seq :
+      print('Datagrama UDP fuera de secuencia.')
+      continue
+
+    now = now_ms()
+    if now is None or abs(int.from_bytes(seq, 'big') - now) > UDP_SEQ_WINDOW_MS :
+      print('Datagrama UDP fuera de la ventana del reloj.')
+      continue
+
+    udp_last_seq = seq
+    sock.sendto(UDP_ACK + seq, addr)
+    relay(data)
+
+
+# Publica el estado de salud cada HEALTH_PERIOD_MS, en cuanto el microcontrolador está en
+# reposo (carril vacío, sin repeticiones pendientes ni emisión en curso) o tras postergarlo
+# un periodo completo. La recolección previa reduce la fragmentación de la memoria y fija
+# la memoria libre reportada :
+def health_task(client) :
+  global health_ref
+
+  elapsed = utime.ticks_diff(utime.ticks_ms(), health_ref)
+  if elapsed < HEALTH_PERIOD_MS :
+    return
+  busy = lane or repeat_pending or utime.ticks_diff(last_end, utime.ticks_ms()) > 0
+  if busy and elapsed < 2*HEALTH_PERIOD_MS :
+    return
+
+  gc.collect()
+  stats['reports'] += 1
+  health = {'uptime_s' : utime.ticks_ms() // 1000, 'mem_free' : gc.mem_free(),
+            'mem_alloc' : gc.mem_alloc(),
+            'rssi' : network.WLAN(network.STA_IF).status('rssi'),
+            'relay_max_us' : relay_us[0],
+            'relay_avg_us' : relay_us[1] // relay_us[2] if relay_us[2] else 0}
+  health.update(stats)
+  client.publish(health_topic, ujson.dumps(health), retain=True)
+
+  relay_us[0] = relay_us[1] = relay_us[2] = 0
+  health_ref = utime.ticks_ms()
+
+
 # task
 def task() :
-  global keepalive_cnt, wifi_timeout, broker_ip, topic
+  global keepalive_ref, wifi_timeout, broker_ip, topic, mqtt_client, health_ref
 
   while 1 :
     num_retries = 5
@@ -155,6 +1118,10 @@ def task() :
       # No se pudo conectar a la red DELFOS. Se termina el proceso, para que a continuación
       # se solicite el cebado del sistema ...
       break
+    stats['wifi'] += 1
+
+    # Sincroniza el reloj para verificar la vigencia de los mensajes :
+    sync_clock()
 
     # Intenta conectarse con el servidor MQTT :
     num_retries = 5
@@ -166,9 +1133,11 @@ def task() :
         # de asegurar su singularidad es agregar el IP :
         client = MQTTClient(client_id_header + network.WLAN(network.STA_IF).ifconfig()[0], broker_ip)
         client.set_callback(relay_code)
+        client.set_last_will(status_topic, b'offline', retain=True)
 
         # Inicia la conexión con el broker :
         client.connect()
+        stats['mqtt'] += 1
 
         print('conectado!')
         break
@@ -188,9 +1157,16 @@ def task() :
     num_retries = 5
     for n in range(num_retries) :
       try :
-        print('[{:d}/{:d}] Suscribiéndose al Tópico <<{:s}>> ... '.format(n+1, num_retries, topic), end='')
+        print('[{:d}/{:d}] Suscribiéndose al Tópico <<{}>> ... '.format(n+1, num_retries, cmd_topic), end='')
         print 
-        client.subscribe(topic)
+        client.subscribe(cmd_topic)
+        # Una sola suscripción para todas las zonas, relay_code() descarta las desconocidas :
+        if zones :
+          client.subscribe(topic + ZONE_SUBTOPIC + b'+')
+        for group_topic in group_topics :
+          client.subscribe(group_topic)
+        client.publish(status_topic, b'online', retain=True)
+        mqtt_client = client
         print('suscrito!')
         break 
         
@@ -206,22 +1182,52 @@ def task() :
       # se solicite el cebado del sistema ...
       break
 
-    # Se continúa con la re-trasmisión de los códigos/patrones recibidos :
-    keepalive_cnt = 0
+    # Se continúa con la re-trasmisión de los códigos/patrones recibidos, el código guardián
+    # se envía de inmediato para que el microcontrolador abandone el tiempo de espera inicial
+    # (INIT_KEEPALIVE_TIMEOUT) en cuanto la conexión está establecida :
+    keepalive_ref = utime.ticks_add(utime.ticks_ms(), -100*KEEPALIVE_PERIOD)
+
+    # Al igual que el estado de salud, para que se publique tras cada conexión :
+    health_ref = utime.ticks_add(utime.ticks_ms(), -HEALTH_PERIOD_MS)
+
+    # En lugar de esperar un periodo fijo entre las verificaciones, se espera por la actividad
+    # en la conexión con el broker o en el socket UDP, para re-dirigir los mensajes de inmediato :
+    poller = uselect.poll()
+    poller.register(client.sock, uselect.POLLIN)
+    sock = udp_open()
+    if sock :
+      poller.register(sock, uselect.POLLIN)
+
     try :
       while network.WLAN(network.STA_IF).isconnected() :
         client_task(client)
+        if sock :
+          udp_task(sock)
 
-        keepalive_cnt += 1
-        if keepalive_cnt >= KEEPALIVE_PERIOD :
+        if utime.ticks_diff(utime.ticks_ms(), keepalive_ref) >= 100*KEEPALIVE_PERIOD :
           # Transcurrió el periodo de tiempo límite, se envía el código guardián para indicar
           # al microcontrolador que sique operando correctamente :
-          hspi.write(KEEPALIVE_CODE)
+          spi_write(KEEPALIVE_CODE)
           
           # Se reinicia el periodo de espera :
-          keepalive_cnt = 0
+          keepalive_ref = utime.ticks_ms()
+
+        if clock_ref and utime.ticks_diff(utime.ticks_ms(), clock_ref[1]) >= CLOCK_RESYNC_MS :
+          sync_clock()
+
+        health_task(client)
 
-        utime.sleep_ms(100)
+        # Los mensajes programados se re-dirigen con la anticipación AT_LEAD_MS, los del
+        # carril normal en cuanto el microcontrolador puede recibirlos, y las repeticiones
+        # acumuladas en cuanto termina la emisión en curso :
+        wait_ms = min(schedule_task(), lane_task())
+        if repeat_pending and not lane :
+          busy_ms = utime.ticks_diff(last_end, utime.ticks_ms())
+          if busy_ms <= 0 and not schedule_hold(pattern_duration_ms(last_frame) * repeat_pending) :
+            repeat_flush()
+          poller.poll(max(0, min(wait_ms, busy_ms)))
+        else :
+          poller.poll(wait_ms)
 
     except Exception as e:
       # Ha ocurrido un error inesperado, se abandona la ejecución normal, lo que implica
@@ -235,7 +1241,7 @@ def task() :
   # cebar el ESP8266 :
   print('Se procede a cebar el sistema.')
   utime.sleep(2)
-  hspi.write(RESET_REQ_CODE)
+  spi_write(RESET_REQ_CODE)
 
 
 if __name__ == '__main__' :
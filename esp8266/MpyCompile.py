@@ -0,0 +1,61 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Compilación cruzada del módulo IRProxy_uPy.py a código de bytes de MicroPython (.mpy) con
+mpy-cross, se ejecuta en la PC (no se copia al módulo ESP8266) :
+
+  python MpyCompile.py [--mpy-cross RUTA]
+
+El módulo excede los 40 KB de fuente, compilarlo en el ESP8266 al importarlo puede requerir
+más memoria de la que queda libre después del arranque (MemoryError), mientras que el .mpy
+se carga sin compilar. mpy-cross debe ser de la misma versión de MicroPython que el firmware
+del módulo (el formato .mpy cambia entre versiones), y el módulo importa el .py antes que
+el .mpy, por lo que IRProxy_uPy.py debe eliminarse del módulo.
+
+El módulo no usa los emisores de código máquina (native/viper), por lo que no se requiere
+'-march=xtensa'. Es compatible con Python 2.7 y 3.
+"""
+
+import os
+import sys
+import argparse
+import subprocess
+
+ESP8266_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(ESP8266_DIR, 'IRProxy_uPy.py')
+
+
+def compile_mpy(mpy_cross, source, output) :
+  u"""
+  Compila 'source' en 'output' con 'mpy_cross', devuelve True si lo logra.
+  """
+  try :
+    version = subprocess.check_output([mpy_cross, '--version']).decode().strip()
+  except (OSError, subprocess.CalledProcessError) as e :
+    print('No se pudo ejecutar %s : %s' % (mpy_cross, e))
+    return False
+
+  print(version)
+  if subprocess.call([mpy_cross, '-o', output, source]) != 0 :
+    print('mpy-cross no pudo compilar %s.' % source)
+    return False
+
+  print('%s : %d bytes, %s : %d bytes' % (os.path.basename(source), os.path.getsize(source),
+                                          os.path.basename(output), os.path.getsize(output)))
+  return True
+
+
+def main() :
+  parser = argparse.ArgumentParser(description='Compilación de IRProxy_uPy.py a .mpy.')
+  parser.add_argument('--mpy-cross', default='mpy-cross', help='Ruta de mpy-cross.')
+  parser.add_argument('--source', default=SOURCE)
+  parser.add_argument('--output', default=None, help='Archivo .mpy (junto a la fuente).')
+  args = parser.parse_args()
+
+  output = args.output or os.path.splitext(args.source)[0] + '.mpy'
+  sys.exit(0 if compile_mpy(args.mpy_cross, args.source, output) else 1)
+
+
+if __name__ == '__main__' :
+  main()
@@ -0,0 +1,297 @@
+// irproxy-encode.js
+//
+// Nodo de Node-RED que codifica las teclas por su nombre (etiqueta ID) a partir de los
+// archivos XML del libro de códigos (pc/*.xml), con el mismo formato que IRCodeBook.py.
+// Los archivos se cargan y codifican una sola vez, al desplegar el flujo.
+//
+// Además limita la tasa de los mensajes hacia el nodo 'mqtt out' : se envía a lo más un
+// mensaje cada 'interval' mseg., y mientras se espera, las pulsaciones repetidas de la
+// misma tecla se agrupan en una sola (coalesce), para que la insistencia en el tablero no
+// sature el broker ni el módulo ESP8266.
+//
+// El formato 'compact' utiliza la versión 2 del protocolo, con la base de tiempo de las
+// duraciones (timeBase(), igual que IRCodeBook.time_base()), si el código es más corto.
+//
+// Si 'ttl' no es 0, cada mensaje lleva el instante de su envío y su vigencia (STAMP_ID),
+// el módulo descarta los que llegan vencidos (e.g. acumulados durante una desconexión).
+//
+// Las teclas de 'urgent' (IDs separados por comas, como IR_URGENT_KEYS de IRCodeBook.py)
+// llevan la prioridad (PATTERN_OPT_PRIORITY), el módulo las emite antes que las pendientes.
+//
+// Como IRCodeBook.load(), se omiten (con una advertencia) los archivos cuyo patrón rechazaría
+// el microcontrolador (checkPattern(), igual que IRCodec.check_pattern()).
+
+var fs = require('fs');
+var path = require('path');
+
+var INFRARED_REMOTE_PROXY_PROTOCOL = 1;
+var INFRARED_REMOTE_PROXY_PROTOCOL_2 = 2;
+var PATTERN_OPT_TIME_BASE = 0x01;
+var PATTERN_OPT_PRIORITY = 0x08;
+var TIME_BASE_TOLERANCE = 0.05;
+var MAX_TIME_BASE = 127;
+var STAMP_ID = 0x7C;
+
+// Límites del microcontrolador (codec/vlq.h) y resultados de checkPattern() :
+var PATTERN_SIZE = 46;
+var PATTERN_OK = 'ok';
+
+// Devuelve el código (hexadecimal) del número 'num' en formato VLQ :
+function encodeNum(num) {
+  var s = '';
+  do {
+    var b = num % 128;
+    num = Math.floor(num / 128);
+    if (num > 0) b += 128;
+    s += (b < 16 ? '0' : '') + b.toString(16).toUpperCase();
+  } while (num > 0);
+  return s;
+}
+
+// Redondea como round() de Python 3 (al par más cercano en los empates), de manera que las
+// duraciones coincidan con las de IRCodeBook.py :
+function roundHalfEven(x) {
+  var r = Math.round(x);
+  return (r - x === 0.5 && r % 2 !== 0) ? r - 1 : r;
+}
+
+// Devuelve PATTERN_OK si el microcontrolador acepta el patrón 'code' (hexadecimal), o el
+// nombre del error con que lo rechazaría (IRCodec.ERRORS) :
+function checkPattern(code) {
+  var data = Buffer.from(code, 'hex');
+  var idx = 0;
+
+  function number(maxBytes) {
+    var num = 0;
+    for (var n = 0; n < maxBytes; n++) {
+      if (idx >= PATTERN_SIZE) throw 'overflow';
+      if (idx >= data.length) throw 'incomplete';
+      var b = data[idx++];
+      num += (b & 0x7F) * Math.pow(128, n);
+      if (!(b & 0x80)) return num;
+    }
+    throw 'number';
+  }
+
+  try {
+    var version = number(1);
+    if (version !== INFRARED_REMOTE_PROXY_PROTOCOL && version !== INFRARED_REMOTE_PROXY_PROTOCOL_2) {
+      return 'unknown';
+    }
+    var numPulses = number(1);
+    var options = version === INFRARED_REMOTE_PROXY_PROTOCOL_2 ? number(1) : 0;
+    var count = 2 + 2 * numPulses;
+    for (var bit = 0x01; bit < 0x80; bit <<= 1) if (options & bit) count++;
+    for (var i = 0; i < count; i++) number(2);
+  } catch (e) {
+    if (typeof e !== 'string') throw e;
+    return e;
+  }
+
+  return idx === data.length ? PATTERN_OK : 'payload';
+}
+
+function tagText(xml, tag) {
+  var m = new RegExp('<' + tag + '[^>]*>([^<]*)</' + tag + '>').exec(xml);
+  if (!m) throw new Error('Falta la etiqueta ' + tag);
+  return m[1].trim();
+}
+
+// Devuelve la mayor base de tiempo con la que el error de cada duración no excede la
+// tolerancia, o 1 :
+function timeBase(pulses) {
+  var counts = [].concat.apply([], pulses);
+  if (!counts.length) return 1;
+  for (var base = Math.min(MAX_TIME_BASE, Math.min.apply(null, counts)); base > 1; base--) {
+    var ok = counts.every(function (n) {
+      return Math.abs(Math.max(1, roundHalfEven(n / base)) * base - n) <= TIME_BASE_TOLERANCE * n;
+    });
+    if (ok) return base;
+  }
+  return 1;
+}
+
+// Devuelve el código del patrón con la base de tiempo 'base' (1 : sin ella), en la versión
+// 2 del protocolo si lleva alguna opción (la prioridad si 'urgent') :
+function encodePattern(period, dutyCycle, pulses, base, urgent) {
+  var options = (base > 1 ? PATTERN_OPT_TIME_BASE : 0) | (urgent ? PATTERN_OPT_PRIORITY : 0);
+  var s;
+  if (options) {
+    s = encodeNum(INFRARED_REMOTE_PROXY_PROTOCOL_2) + encodeNum(pulses.length) + encodeNum(options);
+  } else {
+    s = encodeNum(INFRARED_REMOTE_PROXY_PROTOCOL) + encodeNum(pulses.length);
+  }
+  s += encodeNum(period) + encodeNum(dutyCycle);
+  // Los valores de las opciones siguen el orden de sus bits :
+  if (base > 1) s += encodeNum(base);
+  if (urgent) s += encodeNum(1);
+  pulses.forEach(function (p) {
+    if (base > 1) {
+      s += encodeNum(Math.max(1, roundHalfEven(p[0] / base)));
+      s += encodeNum(Math.max(1, roundHalfEven(p[1] / base)));
+    } else {
+      s += encodeNum(p[0]) + encodeNum(p[1]);
+    }
+  });
+  return s;
+}
+
+// Devuelve el código del patrón, con la base de tiempo si 'compact' y el código es más
+// corto, o una excepción si el microcontrolador lo rechazaría :
+function encodeKey(period, dutyCycle, pulses, compact, urgent) {
+  var s = encodePattern(period, dutyCycle, pulses, 1, urgent);
+
+  var base = compact ? timeBase(pulses) : 1;
+  if (base > 1) {
+    var c = encodePattern(period, dutyCycle, pulses, base, urgent);
+    if (c.length < s.length) s = c;
+  }
+
+  var err = checkPattern(s);
+  if (err !== PATTERN_OK) throw new Error('el microcontrolador rechazaría el patrón : ' + err);
+  return s;
+}
+
+// Devuelve [ID, código] del archivo XML 'file', con prioridad si su ID está en 'urgent' :
+function encodeFile(file, compact, urgent) {
+  var xml = fs.readFileSync(file, 'utf8');
+  var pulses = [];
+  var re = /<PULSE>([\s\S]*?)<\/PULSE>/g;
+  var m;
+  while ((m = re.exec(xml)) !== null) {
+    pulses.push([parseInt(tagText(m[1], 'HIGH'), 10), parseInt(tagText(m[1], 'LOW'), 10)]);
+  }
+
+  var id = tagText(xml, 'ID');
+  var period = parseInt(tagText(xml, 'PERIOD'), 10);
+  var dutyCycle = parseInt(tagText(xml, 'DUTY_CYCLE'), 10);
+  return [id, encodeKey(period, dutyCycle, pulses, compact, (urgent || []).indexOf(id) >= 0)];
+}
+
+// Devuelve el código 'code' con el instante actual y la vigencia 'ttl' (mseg.) :
+function stamp(code, ttl) {
+  var s = encodeNum(STAMP_ID) + encodeNum(Date.now()) + encodeNum(ttl);
+  return Buffer.isBuffer(code) ? Buffer.concat([Buffer.from(s, 'hex'), code]) : s + code;
+}
+
+// Devuelve el libro de códigos {ID : código} del directorio 'dir', los archivos que no
+// pueden codificarse se reportan con 'log' y se omiten :
+function loadCodeBook(dir, log, compact, urgent) {
+  var codebook = {};
+  fs.readdirSync(dir).filter(function (f) { return /\.xml$/i.test(f); }).sort()
+    .forEach(function (f) {
+      try {
+        var entry = encodeFile(path.join(dir, f), compact, urgent);
+        codebook[entry[0]] = entry[1];
+      } catch (e) {
+        log('No se pudo codificar el archivo ' + f + ' : ' + e.message);
+      }
+    });
+  return codebook;
+}
+
+module.exports = function (RED) {
+  function IRProxyEncodeNode(config) {
+    RED.nodes.createNode(this, config);
+    var node = this;
+
+    node.format = config.format || 'hex';
+    node.interval = parseInt(config.interval, 10) || 0;
+    node.coalesce = config.coalesce !== false;
+    node.maxQueue = parseInt(config.maxQueue, 10) || 10;
+    node.ttl = parseInt(config.ttl, 10) || 0;
+    node.urgent = (config.urgent || '').split(',').map(function (k) { return k.trim(); })
+      .filter(function (k) { return k; });
+
+    // Códigos en el formato de salida, calculados una sola vez :
+    node.codes = {};
+    try {
+      var codebook = loadCodeBook(config.patterns, node.warn.bind(node),
+                                  node.format === 'compact', node.urgent);
+      Object.keys(codebook).forEach(function (id) {
+        node.codes[id] = node.format === 'binary' ? Buffer.from(codebook[id], 'hex')
+                                                  : codebook[id];
+      });
+      node.status({fill: 'green', shape: 'dot', text: Object.keys(node.codes).length + ' teclas'});
+    } catch (e) {
+      node.error('No se pudo cargar el libro de códigos : ' + e.message);
+      node.status({fill: 'red', shape: 'ring', text: 'sin libro de códigos'});
+    }
+
+    node.queue = [];
+    node.lastSent = 0;
+    node.timer = null;
+    node.counters = {sent: 0, coalesced: 0, dropped: 0};
+
+    function showQueue() {
+      node.status({fill: node.queue.length ? 'yellow' : 'green', shape: 'dot',
+                   text: 'cola : ' + node.queue.length + ', agrupadas : ' + node.counters.coalesced});
+    }
+
+    function flush() {
+      node.timer = null;
+      while (node.queue.length) {
+        var wait = node.lastSent + node.interval - Date.now();
+        if (wait > 0) {
+          node.timer = setTimeout(flush, wait);
+          break;
+        }
+        var entry = node.queue.shift();
+        node.lastSent = Date.now();
+        node.counters.sent++;
+        if (node.ttl) entry.msg.payload = stamp(entry.msg.payload, node.ttl);
+        entry.send(entry.msg);
+        entry.done();
+      }
+      showQueue();
+    }
+
+    node.on('input', function (msg, send, done) {
+      send = send || function () { node.send.apply(node, arguments); };
+      done = done || function (err) { if (err) node.error(err, msg); };
+
+      var key = msg.key || msg.payload;
+      var code = node.codes[key];
+      if (code === undefined) {
+        done('Tecla desconocida : ' + key);
+        return;
+      }
+
+      // Una pulsación de la tecla que ya espera en la cola no genera un nuevo mensaje :
+      var last = node.queue[node.queue.length - 1];
+      if (node.coalesce && last && last.key === key) {
+        node.counters.coalesced++;
+        showQueue();
+        done();
+        return;
+      }
+
+      if (node.queue.length >= node.maxQueue) {
+        node.counters.dropped++;
+        done('Cola llena, se descarta la tecla ' + key);
+        return;
+      }
+
+      msg.key = key;
+      msg.payload = code;
+      node.queue.push({key: key, msg: msg, send: send, done: done});
+      if (!node.timer) flush();
+    });
+
+    node.on('close', function () {
+      if (node.timer) clearTimeout(node.timer);
+      node.timer = null;
+      node.queue.forEach(function (entry) { entry.done(); });
+      node.queue = [];
+    });
+  }
+
+  RED.nodes.registerType('irproxy-encode', IRProxyEncodeNode);
+};
+
+module.exports.encodeNum = encodeNum;
+module.exports.timeBase = timeBase;
+module.exports.checkPattern = checkPattern;
+module.exports.encodeKey = encodeKey;
+module.exports.stamp = stamp;
+module.exports.loadCodeBook = loadCodeBook;
@@ -0,0 +1,480 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Codificación de los patrones infrarrojos definidos en los archivos XML y su agrupación en
+el libro de códigos (code-book), compartida por la aplicación de Kivy y el servicio de
+mandos sin interfaz gráfico (IRProxy_Daemon.py).
+"""
+
+import os
+import glob
+import time
+import threading
+import collections.abc
+
+import IRCodec
+
+# Versión del Protocolo de Mando Remoto por  Señales Infrarrojas :
+INFRARED_REMOTE_PROXY_PROTOCOL = 1
+
+# La versión 2 agrega la máscara de opciones, con la base de tiempo (en periodos de la
+# portadora) de las duraciones de los pulsos, que se eligen de manera que el error de cada
+# duración no exceda TIME_BASE_TOLERANCE :
+INFRARED_REMOTE_PROXY_PROTOCOL_2 = 2
+PATTERN_OPT_TIME_BASE = 0x01
+PATTERN_OPT_OUTPUTS = 0x02
+PATTERN_OPT_DELAY = 0x04
+PATTERN_OPT_PRIORITY = 0x08
+TIME_BASE_TOLERANCE = 0.05
+MAX_TIME_BASE = 127
+
+# Identificación de la secuencia de teclas (macro), interpretada por el módulo ESP8266 :
+MACRO_ID = 0x7D
+
+# Tópicos : los de cada equipo cuelgan de TOPIC_ROOT/<sitio>/<cuarto>/<equipo> (IR_SITE,
+# IR_ROOM e IR_DEVICE en secrets), los mensajes se publican en CMD_SUBTOPIC y el módulo
+# ESP8266 publica su estado (retenido) en STATUS_SUBTOPIC, y el de salud (JSON, retenido) en
+# HEALTH_SUBTOPIC. Un mensaje publicado en el tópico
+# de un grupo (TOPIC_ROOT/<sitio>/group/<grupo>/cmd) lo reciben todos los equipos del sitio
+# suscritos a él (IR_GROUPS) :
+TOPIC_ROOT = 'ir_proxy'
+CMD_SUBTOPIC = '/cmd'
+STATUS_SUBTOPIC = '/status'
+HEALTH_SUBTOPIC = '/health'
+GROUP_LEVEL = '/group/'
+DEFAULT_SITE = 'casa'
+DEFAULT_ROOM = 'sala'
+DEFAULT_DEVICE = 'deco_tv'
+
+# Zonas : los mensajes publicados en el tópico de una zona (ZONE_SUBTOPIC seguido de su
+# nombre, relativo al tópico del equipo) se emiten por las salidas del microcontrolador
+# asignadas a ella (IR_ZONES en la configuración del módulo ESP8266) :
+ZONE_SUBTOPIC = '/zone/'
+
+# Solicitud de aprendizaje de un patrón, el módulo ESP8266 publica el patrón capturado por el
+# microcontrolador en el tópico LEARNED_SUBTOPIC (relativo al tópico del equipo) :
+LEARN_ID = 0x7B
+LEARN_MIN_PERIOD = 4
+LEARNED_SUBTOPIC = '/learned'
+
+# Solicitud del registro de eventos del microcontrolador (IRTrace.py), el módulo ESP8266 lo
+# publica en el tópico TRACE_SUBTOPIC :
+TRACE_ID = 0x79
+TRACE_SUBTOPIC = '/trace'
+
+# Mensaje con vigencia, el módulo ESP8266 descarta los que llegan después de COMMAND_TTL
+# mseg. de su envío (e.g. acumulados durante una desconexión) o fuera de orden :
+STAMP_ID = 0x7C
+COMMAND_TTL = 3000
+
+# Emisión programada, el módulo ESP8266 (con su reloj sincronizado por SNTP) retiene el
+# mensaje e inicia la emisión del patrón en el instante indicado, de manera que varios
+# equipos emiten a la vez :
+AT_ID = 0x78
+
+# Prioridad (PATTERN_OPT_PRIORITY) : los patrones urgentes no esperan tras los demás en el
+# módulo ESP8266 y cancelan las repeticiones pendientes en el microcontrolador, de manera
+# que su emisión inicia a lo más al terminar la repetición en curso. load() marca así las
+# teclas (etiqueta ID) de IR_URGENT_KEYS en secrets (urgent_keys()), o las URGENT_KEYS :
+URGENT_KEYS = ('Power', 'Mute')
+
+# Periodo de verificación de los cambios de los archivos XML (LiveCodeBook.watch(), seg.) :
+RELOAD_PERIOD = 1.0
+
+
+def encode_num(num) :
+  """
+  Devuelve el código correspondiente al número 'num' (codec/vlq.c, por IRCodec).
+  """
+  # El cero también se codifica (con un byte), pues es un valor válido en las macros :
+  return IRCodec.encode_num(num)
+
+
+def read_pattern(file) :
+  u"""
+  Devuelve (periodo, periodo activo, [(high, low), ...]) del patrón definido en el archivo
+  XML 'file'.
+  """
+  import xml.etree.ElementTree as etree
+
+  # Lee e interpreta el archivo de definición ...
+  xml_root = etree.parse(file).getroot()
+
+  xml_carrier = xml_root.find('CARRIER')
+  period = int(xml_carrier.find('PERIOD').text.strip())
+  duty_cycle = int(xml_carrier.find('DUTY_CYCLE').text.strip())
+
+  pulses = []
+  for p in xml_root.find('PATTERN') :
+    pulses.append((int(p.find('HIGH').text.strip()), int(p.find('LOW').text.strip())))
+
+  return period, duty_cycle, pulses
+
+
+def time_base(pulses, tolerance=TIME_BASE_TOLERANCE) :
+  u"""
+  Devuelve la mayor base de tiempo (en periodos de la portadora, hasta MAX_TIME_BASE) con
+  la que la duración de cada parte de los pulsos se conserva dentro de la tolerancia
+  relativa 'tolerance', o 1 si no existe.
+  """
+  counts = [n for p in pulses for n in p]
+  if not counts :
+    return 1
+
+  for base in range(min(MAX_TIME_BASE, min(counts)), 1, -1) :
+    if all(abs(max(1, round(float(n) / base)) * base - n) <= tolerance * n for n in counts) :
+      return base
+
+  return 1
+
+
+def encode_pattern(period, duty_cycle, pulses, compact=False) :
+  u"""
+  Devuelve el código del patrón. Con 'compact' se utiliza la versión 2 del protocolo con
+  la base de tiempo (time_base()), si el código resultante es más corto.
+  """
+  nums = [INFRARED_REMOTE_PROXY_PROTOCOL, len(pulses), period, duty_cycle]
+  for high, low in pulses :
+    nums += [high, low]
+  s = IRCodec.encode_frame(nums)
+
+  base = time_base(pulses) if compact else 1
+  if base == 1 :
+    return s
+
+  nums = [INFRARED_REMOTE_PROXY_PROTOCOL_2, len(pulses), PATTERN_OPT_TIME_BASE, period,
+          duty_cycle, base]
+  for high, low in pulses :
+    nums += [max(1, int(round(float(high) / base))), max(1, int(round(float(low) / base)))]
+  c = IRCodec.encode_frame(nums)
+
+  return c if len(c) < len(s) else s
+
+
+def add_option(code, opt, value) :
+  u"""
+  Devuelve el patrón 'code' (versión 1 o 2) con la opción 'opt' de valor 'value', i.e. en
+  la versión 2 del protocolo (los valores de las opciones siguen el orden de sus bits).
+  """
+  numbers = IRCodec.decode_frame(code)
+  if numbers and numbers[0] == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    options = numbers.pop(2)
+  elif numbers and numbers[0] == INFRARED_REMOTE_PROXY_PROTOCOL :
+    options = 0
+  else :
+    raise ValueError('El código no corresponde a un patrón.')
+
+  bits = [1 << i for i in range(7) if options & (1 << i)]
+  values = dict(zip(bits, numbers[4:4+len(bits)]))
+  values[opt] = value
+  nums = [INFRARED_REMOTE_PROXY_PROTOCOL_2, numbers[1], options | opt] + numbers[2:4]
+  nums += [values[bit] for bit in sorted(values)] + numbers[4+len(bits):]
+  return IRCodec.encode_frame(nums)
+
+
+def urgent(code, priority=1) :
+  u"""
+  Devuelve el patrón 'code' con la prioridad 'priority' (PATTERN_OPT_PRIORITY).
+  """
+  return add_option(code, PATTERN_OPT_PRIORITY, priority)
+
+
+def encode(file, compact=False):
+    u"""
+    Devuelve el código del patrón definido en el archivo XML 'file'.
+    """
+    period, duty_cycle, pulses = read_pattern(file)
+    return encode_pattern(period, duty_cycle, pulses, compact)
+
+
+def encode_macro(steps) :
+  u"""
+  Devuelve el código de la secuencia de teclas 'steps', lista de pares (espera, código)
+  donde la espera (en mseg.) es la pausa entre el fin de la emisión del patrón anterior y
+  el inicio del siguiente, y código es el devuelto por encode().
+
+  El formato es :
+    [MACRO_ID] [Número de pasos] ([Espera] [Longitud del patrón] [Patrón]) ...
+
+  Los patrones repetidos se codifican como una referencia al paso previo en que aparecen,
+  con longitud 0 seguida del índice de dicho paso.
+  """
+  s = encode_num(MACRO_ID) + encode_num(len(steps))
+  first = {}
+  for i, (gap, code) in enumerate(steps) :
+    s += encode_num(int(gap))
+    if code in first :
+      s += encode_num(0) + encode_num(first[code])
+    else :
+      first[code] = i
+      s += encode_num(len(code) // 2) + code
+
+  return s
+
+
+def stamp(code, ttl=COMMAND_TTL, now=None) :
+  u"""
+  Devuelve el código 'code' con el instante de envío (mseg. desde 1970, 'now' en seg. o el
+  actual) y su vigencia 'ttl' (mseg.) :
+    [STAMP_ID] [Instante] [Vigencia] [Código]
+  """
+  ms = int(1e3 * (time.time() if now is None else now))
+  return encode_num(STAMP_ID) + encode_num(ms) + encode_num(int(ttl)) + code
+
+
+def device_topic(config={}, device=None) :
+  u"""
+  Devuelve el tópico del equipo configurado en 'config' (e.g. globals() tras importar
+  secrets), o del equipo 'device' ('<cuarto>/<equipo>') del mismo sitio.
+  """
+  site = config.get('IR_SITE', DEFAULT_SITE)
+  if device is None :
+    device = config.get('IR_ROOM', DEFAULT_ROOM) + '/' + config.get('IR_DEVICE', DEFAULT_DEVICE)
+  return TOPIC_ROOT + '/' + site + '/' + device
+
+
+def command_topic(topic) :
+  u"""
+  Devuelve el tópico de los mensajes del equipo de tópico 'topic'.
+  """
+  return topic + CMD_SUBTOPIC
+
+
+def urgent_keys(config={}) :
+  u"""
+  Devuelve las teclas urgentes (IR_URGENT_KEYS) configuradas en 'config' (e.g. globals()
+  tras importar secrets), o URGENT_KEYS.
+  """
+  return tuple(config.get('IR_URGENT_KEYS', URGENT_KEYS))
+
+
+def group_topic(group, config={}) :
+  u"""
+  Devuelve el tópico de los mensajes del grupo 'group' del sitio configurado en 'config'.
+  """
+  return TOPIC_ROOT + '/' + config.get('IR_SITE', DEFAULT_SITE) + GROUP_LEVEL + group + CMD_SUBTOPIC
+
+
+def at(code, when) :
+  u"""
+  Devuelve el código 'code' programado para emitirse en el instante 'when' (seg. desde
+  1970) :
+    [AT_ID] [Instante (mseg.)] [Código]
+  Para que además tenga vigencia, stamp() debe envolver el código programado.
+  """
+  return encode_num(AT_ID) + encode_num(int(round(1e3 * when))) + code
+
+
+def zone_topic(topic, zone) :
+  u"""
+  Devuelve el tópico de los mensajes de la zona 'zone' del equipo de tópico 'topic'.
+  """
+  return topic + ZONE_SUBTOPIC + zone
+
+
+def encode_learn(period, duty_cycle) :
+  u"""
+  Devuelve el código de la solicitud de aprendizaje, el patrón capturado utilizará la
+  portadora (periodo y periodo activo en unidades de 1/FOSC) indicada, pues el receptor del
+  microcontrolador la elimina. El periodo debe ser al menos LEARN_MIN_PERIOD.
+  """
+  if period < LEARN_MIN_PERIOD :
+    raise ValueError('El periodo de la portadora debe ser al menos {}.'.format(LEARN_MIN_PERIOD))
+  payload = encode_num(period) + encode_num(duty_cycle)
+  return encode_num(LEARN_ID) + encode_num(len(payload) // 2) + payload
+
+
+def encode_trace() :
+  u"""
+  Devuelve el código de la solicitud del registro de eventos.
+  """
+  return encode_num(TRACE_ID) + encode_num(0)
+
+
+def decode(code) :
+  u"""
+  Devuelve (periodo, periodo activo, [(high, low), ...]) del patrón 'code', la operación
+  inversa de encode().
+  """
+  numbers = IRCodec.decode_frame(code)
+
+  base = 1
+  if len(numbers) > 5 and numbers[0] == INFRARED_REMOTE_PROXY_PROTOCOL_2 :
+    # Se reordena como la versión 1, las duraciones se expresan en periodos de la portadora :
+    options = numbers.pop(2)
+    count = bin(options).count('1')
+    extra, numbers[4:4+count] = numbers[4:4+count], []
+    if options & PATTERN_OPT_TIME_BASE :
+      base = extra[0]
+    numbers[0] = INFRARED_REMOTE_PROXY_PROTOCOL
+
+  if len(numbers) < 4 or numbers[0] != INFRARED_REMOTE_PROXY_PROTOCOL \
+     or len(numbers) != 4 + 2*numbers[1] :
+    raise ValueError('El código no corresponde a un patrón.')
+
+  pulses = [n * base for n in numbers[4:]]
+  return numbers[2], numbers[3], list(zip(pulses[0::2], pulses[1::2]))
+
+
+def to_xml(code, id, source) :
+  u"""
+  Devuelve el archivo XML (con el formato de los existentes) del patrón 'code', por ejemplo
+  el publicado por el módulo tras el aprendizaje de una tecla.
+  """
+  period, duty_cycle, pulses = decode(code)
+  s = '<?xml version="1.0" encoding="UTF-8"?>\n<IR_CODE>\n'
+  s += '   <SOURCE>\n       %s\n   </SOURCE>\n\n' % source
+  s += '   <ID>\n       %s\n   </ID>\n\n' % id
+  s += '   <CARRIER unit = "3.125000e-08 seg"> \n'
+  s += '      <PERIOD> %d </PERIOD>\n      <DUTY_CYCLE> %d </DUTY_CYCLE>\n' % (period, duty_cycle)
+  s += '   </CARRIER>\n\n   <PATTERN type="array" unit="CARRIER_PERIOD">\n\n'
+  for high, low in pulses :
+    s += '       <PULSE> \n         <HIGH> %d </HIGH>\n         <LOW> %d </LOW>\n' % (high, low)
+    s += '       </PULSE>\n\n'
+  s += '   </PATTERN>\n</IR_CODE>\n'
+  return s
+
+
+def key_id(file) :
+  u"""
+  Devuelve la identificación de la tecla (etiqueta ID) definida en el archivo XML 'file'.
+  """
+  import xml.etree.ElementTree as etree
+
+  return etree.parse(file).getroot().find('ID').text.strip()
+
+
+def load_file(file, compact=False, urgent_keys=URGENT_KEYS) :
+  u"""
+  Devuelve (ID de la tecla, código) del archivo XML 'file' (codificado con la base de tiempo
+  si 'compact', y con prioridad si la tecla está en 'urgent_keys'), o None si no puede
+  interpretarse o el microcontrolador rechazaría su patrón (IRCodec.check_pattern()), lo
+  que se reporta.
+  """
+  try :
+    key = key_id(file)
+    code = encode(file, compact)
+    if key in urgent_keys :
+      code = urgent(code)
+  except Exception as e :
+    print('No se pudo codificar el archivo %s : %r' % (file, e))
+    return None
+
+  err = IRCodec.check_pattern(code)
+  if err != IRCodec.OK :
+    print('El microcontrolador rechazaría el patrón del archivo %s : %s' %
+          (file, IRCodec.ERRORS[err]))
+    return None
+  return key, code
+
+
+def load(path='.', compact=False, urgent_keys=URGENT_KEYS) :
+  u"""
+  Devuelve el libro de códigos, i.e. el diccionario {ID de la tecla : código}, de todos
+  los archivos XML del directorio 'path' (load_file()), los que no pueden interpretarse o
+  cuyo patrón rechazaría el microcontrolador se reportan y se omiten.
+  """
+  codebook = {}
+  for file in sorted(glob.glob(os.path.join(path, '*.xml'))) :
+    loaded = load_file(file, compact, urgent_keys)
+    if loaded is not None :
+      codebook[loaded[0]] = loaded[1]
+
+  return codebook
+
+
+class LiveCodeBook(collections.abc.Mapping) :
+  u"""
+  Libro de códigos que se actualiza con los cambios de los archivos XML del directorio
+  'path', sin reiniciar la aplicación : reload() codifica solo los archivos nuevos o
+  modificados (fecha y tamaño) y descarta las teclas de los eliminados. Un archivo que no
+  puede codificarse se reporta y su tecla conserva el código anterior, hasta que se corrija.
+
+  Los cambios se aplican sobre una copia de la tabla que luego la reemplaza, de manera que
+  los envíos en curso nunca ven una tabla a medio actualizar; snapshot() devuelve la tabla
+  vigente para consultar varias teclas de manera consistente. Se usa como un diccionario de
+  solo lectura, y watch() inicia la verificación periódica en un hilo propio.
+  """
+
+  def __init__(self, path='.', compact=False, urgent_keys=URGENT_KEYS) :
+    self.path, self.compact, self.urgent_keys = path, compact, urgent_keys
+    self.codes = {}
+    self.files = {}     # {archivo : (fecha, tamaño, ID de la tecla o None)}
+    self.lock = threading.Lock()
+    self.reload()
+
+  def snapshot(self) :
+    return self.codes
+
+  def __getitem__(self, key) :
+    return self.codes[key]
+
+  def __iter__(self) :
+    return iter(self.codes)
+
+  def __len__(self) :
+    return len(self.codes)
+
+  def reload(self) :
+    u"""
+    Aplica los cambios de los archivos XML, devuelve la lista de teclas actualizadas o
+    eliminadas.
+    """
+    with self.lock :
+      codes, files, changed = None, {}, []
+      for file in sorted(glob.glob(os.path.join(self.path, '*.xml'))) :
+        try :
+          st = os.stat(file)
+        except OSError :
+          continue
+        stamp = (st.st_mtime_ns, st.st_size)
+        previous = self.files.get(file)
+        if previous is not None and previous[:2] == stamp :
+          files[file] = previous
+          continue
+
+        if codes is None :
+          codes = dict(self.codes)
+        loaded = load_file(file, self.compact, self.urgent_keys)
+        if loaded is None :
+          # Se conserva la versión anterior de la tecla :
+          files[file] = stamp + (previous[2] if previous else None,)
+          continue
+        key, code = loaded
+        if previous is not None and previous[2] not in (None, key) :
+          codes.pop(previous[2], None)
+          changed.append(previous[2])
+        if codes.get(key) != code :
+          codes[key] = code
+          changed.append(key)
+        files[file] = stamp + (key,)
+
+      # Teclas de los archivos eliminados (o cuya tecla ya no define ninguno) :
+      keys = set(entry[2] for entry in files.values())
+      for file, entry in self.files.items() :
+        if file not in files and entry[2] is not None and entry[2] not in keys :
+          if codes is None :
+            codes = dict(self.codes)
+          codes.pop(entry[2], None)
+          changed.append(entry[2])
+
+      self.files = files
+      if codes is not None :
+        self.codes = codes
+      return changed
+
+  def watch(self, period=RELOAD_PERIOD) :
+    u"""
+    Verifica los cambios cada 'period' seg. en un hilo propio, reporta las teclas
+    actualizadas.
+    """
+    def run() :
+      while True :
+        time.sleep(period)
+        changed = self.reload()
+        if changed :
+          print('Libro de códigos actualizado : %s' % ', '.join(sorted(changed)))
+
+    threading.Thread(target=run, daemon=True).start()
+    return self
@@ -0,0 +1,216 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Acceso desde Python a la codificación VLQ de los mensajes (codec/vlq.c), la misma que
+compila el microcontrolador, cargada por ctypes.
+
+La biblioteca (codec/libvlq.so) se compila con el compilador de C del sistema la primera
+vez que se necesita; si no es posible se utiliza la implementación en Python equivalente,
+BACKEND indica cuál está en uso ('c' o 'python').
+"""
+
+import os
+import ctypes
+import threading
+import subprocess
+
+CODEC_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'codec')
+LIBRARY = os.path.join(CODEC_DIR, 'libvlq.so')
+
+# Límites y resultados de vlq.h :
+MAX_BYTES = 10
+MAX_NUMBER = (1 << 64) - 1
+PATTERN_SIZE = 46
+INVALID = 0xFFFF
+
+OK = 0
+ERR_INCOMPLETE = 1
+ERR_OVERFLOW = 2
+ERR_NUMBER = 3
+ERR_UNKNOWN = 4
+ERR_PAYLOAD = 5
+ERRORS = {ERR_INCOMPLETE : 'incomplete', ERR_OVERFLOW : 'overflow', ERR_NUMBER : 'number',
+          ERR_UNKNOWN : 'unknown', ERR_PAYLOAD : 'payload'}
+
+
+def _build() :
+  u"""
+  Compila codec/libvlq.so si no existe o es más antigua que las fuentes.
+  """
+  sources = [os.path.join(CODEC_DIR, f) for f in ('vlq.c', 'vlq.h')]
+  if os.path.exists(LIBRARY) and \
+     os.path.getmtime(LIBRARY) >= max(os.path.getmtime(f) for f in sources) :
+    return
+  cc = os.environ.get('CC', 'cc')
+  subprocess.check_call([cc, '-O2', '-shared', '-fPIC', '-o', LIBRARY, sources[0]],
+                        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def _load() :
+  try :
+    _build()
+    lib = ctypes.CDLL(LIBRARY)
+  except (OSError, subprocess.CalledProcessError) :
+    return None
+
+  u16, u8p, chp = ctypes.c_uint16, ctypes.POINTER(ctypes.c_uint8), ctypes.c_char_p
+  lib.vlq_encode_frame.argtypes = [ctypes.POINTER(ctypes.c_uint64), u16, u8p, u16]
+  lib.vlq_encode_frame.restype = u16
+  lib.vlq_decode_frame.argtypes = [u8p, u16, ctypes.POINTER(ctypes.c_uint64), u16]
+  lib.vlq_decode_frame.restype = u16
+  lib.vlq_check_pattern.argtypes = [u8p, u16]
+  lib.vlq_check_pattern.restype = ctypes.c_uint8
+  lib.vlq_to_hex.argtypes = [u8p, u16, chp, u16]
+  lib.vlq_to_hex.restype = u16
+  lib.vlq_from_hex.argtypes = [chp, u16, u8p, u16]
+  lib.vlq_from_hex.restype = u16
+  return lib
+
+_lib = None if os.environ.get('IR_CODEC') == 'python' else _load()
+BACKEND = 'c' if _lib is not None else 'python'
+
+# Buffers de la biblioteca, reutilizados en cada invocación (los mensajes más largos se
+# codifican en Python). Se protegen con _lock, pues varios hilos codifican a la vez (e.g.
+# en IRProxy_Daemon.py la actualización del libro de códigos, los interfaces y el envío) :
+BUFFER_NUMBERS = 256
+_nums = (ctypes.c_uint64 * BUFFER_NUMBERS)()
+_frame = (ctypes.c_uint8 * (MAX_BYTES * BUFFER_NUMBERS))()
+_text = ctypes.create_string_buffer(2 * len(_frame) + 1)
+_lock = threading.Lock()
+
+
+def _check(nums) :
+  for n in nums :
+    if type(n) != int :
+      raise TypeError('Solo se codifican números enteros.')
+    if n < 0 or n > MAX_NUMBER :
+      raise ValueError('El número %d no puede codificarse.' % n)
+
+
+def _to_bytes(code) :
+  u"""
+  Devuelve el mensaje 'code' (hexadecimal, str o bytes) como bytes.
+  """
+  if isinstance(code, str) :
+    return bytes.fromhex(code)
+  return bytes.fromhex(code.decode())
+
+
+# Implementación en Python, idéntica a la de vlq.c :
+
+def _py_encode_frame(nums) :
+  s = bytearray()
+  for num in nums :
+    while num > 0x7F :
+      s.append(0x80 | (num & 0x7F))
+      num >>= 7
+    s.append(num)
+  return s.hex().upper()
+
+
+def _py_decode_frame(data) :
+  numbers, num, n = [], 0, 0
+  for b in data :
+    num |= (b & 0x7F) << (7 * n)
+    n += 1
+    if not (b & 0x80) :
+      numbers.append(num & MAX_NUMBER)
+      num, n = 0, 0
+    elif n >= MAX_BYTES :
+      return None
+  return numbers if n == 0 else None
+
+
+class _Error(Exception) :
+  pass
+
+
+def _py_check_pattern(data) :
+  idx = [0]
+
+  def number(max_bytes) :
+    num = 0
+    for n in range(max_bytes) :
+      if idx[0] >= PATTERN_SIZE :
+        raise _Error(ERR_OVERFLOW)
+      if idx[0] >= len(data) :
+        raise _Error(ERR_INCOMPLETE)
+      b = data[idx[0]]
+      idx[0] += 1
+      num |= (b & 0x7F) << (7 * n)
+      if not (b & 0x80) :
+        return num
+    raise _Error(ERR_NUMBER)
+
+  try :
+    version = number(1)
+    if version not in (1, 2) :
+      return ERR_UNKNOWN
+    num_pulses = number(1)
+    options = number(1) if version == 2 else 0
+    for _ in range(2 + bin(options & 0x7F).count('1') + 2 * num_pulses) :
+      number(2)
+  except _Error as e :
+    return e.args[0]
+
+  return OK if idx[0] == len(data) else ERR_PAYLOAD
+
+
+def encode_frame(nums) :
+  u"""
+  Devuelve el mensaje (hexadecimal) con los números 'nums'.
+  """
+  nums = list(nums)
+  _check(nums)
+  if _lib is None :
+    return _py_encode_frame(nums)
+
+  count = len(nums)
+  if count > len(_nums) :
+    return _py_encode_frame(nums)
+
+  with _lock :
+    _nums[:count] = nums
+    length = _lib.vlq_encode_frame(_nums, count, _frame, len(_frame))
+    _lib.vlq_to_hex(_frame, length, _text, len(_text))
+    return _text.value.decode()
+
+
+def encode_num(num) :
+  u"""
+  Devuelve el código (hexadecimal) del número 'num', el cero se codifica con un byte.
+  """
+  return encode_frame([num])
+
+
+def decode_frame(code) :
+  u"""
+  Devuelve la lista de números del mensaje 'code' (hexadecimal), genera ValueError si
+  termina con un número incompleto.
+  """
+  data = _to_bytes(code)
+  if _lib is None :
+    nums = _py_decode_frame(data)
+  else :
+    buf = (ctypes.c_uint8 * max(1, len(data))).from_buffer_copy(data or b'\0')
+    out = (ctypes.c_uint64 * max(1, len(data)))()
+    count = _lib.vlq_decode_frame(buf, len(data), out, len(out))
+    nums = None if count == INVALID else list(out[:count])
+
+  if nums is None :
+    raise ValueError('El mensaje termina con un número incompleto.')
+  return nums
+
+
+def check_pattern(code) :
+  u"""
+  Devuelve OK si el microcontrolador acepta el patrón 'code' (hexadecimal), o el código
+  del error con que lo rechazaría (ERRORS).
+  """
+  data = _to_bytes(code)
+  if _lib is None :
+    return _py_check_pattern(data)
+
+  buf = (ctypes.c_uint8 * max(1, len(data))).from_buffer_copy(data or b'\0')
+  return _lib.vlq_check_pattern(buf, len(data))
@@ -0,0 +1,82 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Envío directo de los mensajes al módulo ESP8266 por UDP, sin pasar por el broker MQTT.
+
+Cada datagrama contiene [Secuencia (6 bytes)] [MAC (8 bytes)] [Mensaje binario]. La
+secuencia es el tiempo en mseg. (big-endian), forzada a ser creciente, y el MAC son los
+primeros bytes del HMAC-SHA256 de la secuencia y el mensaje con la clave compartida
+(UDP_KEY). El módulo confirma los mensajes aceptados devolviendo [0x06] [Secuencia] antes
+de re-dirigirlos, si la confirmación no llega en UDP_ACK_TIMEOUT el envío se considera
+fallido y el cliente debe recurrir al broker MQTT (el módulo descarta el mensaje repetido si
+el primero llegó). El módulo solo acepta las secuencias cercanas a su reloj (SNTP), por lo
+que el reloj de la PC debe estar sincronizado.
+"""
+
+import time
+import hmac
+import socket
+import hashlib
+import binascii
+import threading
+
+UDP_PORT = 4210
+UDP_SEQ_SIZE = 6
+UDP_MAC_SIZE = 8
+UDP_ACK = b'\x06'
+
+# Tiempo de espera por la confirmación (seg.) :
+UDP_ACK_TIMEOUT = 0.05
+
+
+class UDPLink(object) :
+  u"""
+  Enlace directo con el módulo ESP8266 en la dirección (host, port).
+  """
+
+  def __init__(self, host, port, key, timeout=UDP_ACK_TIMEOUT) :
+    self.address = (host, port)
+    self.key = key.encode('utf-8') if isinstance(key, str) else key
+    self.timeout = timeout
+    self.last_seq = 0
+    self.lock = threading.Lock()
+    self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+  def next_seq(self) :
+    self.last_seq = max(self.last_seq + 1, int(time.time() * 1000))
+    return self.last_seq.to_bytes(UDP_SEQ_SIZE, 'big')
+
+  def send(self, code) :
+    u"""
+    Envía el mensaje 'code' (representación hexadecimal, igual que en MQTT), devuelve True
+    si el módulo confirmó su recepción.
+    """
+    data = binascii.unhexlify(code)
+    with self.lock :
+      seq = self.next_seq()
+      digest = hmac.new(self.key, seq + data, hashlib.sha256).digest()[:UDP_MAC_SIZE]
+      try :
+        self.sock.sendto(seq + digest + data, self.address)
+        deadline = time.monotonic() + self.timeout
+        while True :
+          remaining = deadline - time.monotonic()
+          if remaining <= 0 :
+            return False
+          self.sock.settimeout(remaining)
+          ack, addr = self.sock.recvfrom(64)
+          if ack == UDP_ACK + seq :
+            return True
+      except OSError :
+        return False
+
+
+def open_link(config) :
+  u"""
+  Devuelve el enlace definido en la configuración 'config' (IRPROXY_HOST, UDP_PORT y
+  UDP_KEY del archivo secrets), o None si no esta definido.
+  """
+  if 'IRPROXY_HOST' not in config or 'UDP_KEY' not in config :
+    return None
+
+  return UDPLink(config['IRPROXY_HOST'], config.get('UDP_PORT', UDP_PORT), config['UDP_KEY'])
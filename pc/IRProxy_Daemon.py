@@ -0,0 +1,311 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Servicio de mandos sin interfaz gráfico.
+
+Carga el libro de códigos (los archivos XML del directorio de patrones) y lo actualiza con
+los archivos nuevos o modificados sin reiniciarse (IRCodeBook.LiveCodeBook), mantiene una única conexión persistente con el broker MQTT y expone un interfaz local
+(HTTP y opcionalmente un socket Unix) que acepta lotes de teclas, por ejemplo :
+
+  POST /send   {"keys" : ["K1", "K2", "K3"], "interval" : 0.25}
+  POST /send   {"keys" : [{"key" : "K1", "delay" : 0.3}, "K2", "K3"]}
+  POST /send   {"keys" : ["K1", "K2", "K3"], "interval" : 0.1, "macro" : true}
+  POST /send   {"keys" : ["K1"], "zone" : "tv"}
+  POST /send   {"keys" : ["K1"], "device" : "cuarto/tv"}
+  POST /send   {"keys" : ["K1"], "group" : "tvs", "at" : 1760000000.5}
+  GET  /status
+
+Cada tecla del lote se encola y se publica en orden, seguida de la espera (en segundos)
+indicada para la tecla o del intervalo del lote (DEFAULT_INTERVAL por omisión). El estado
+informa la profundidad de la cola y la latencia de cada mando, medida desde que se extrae
+de la cola hasta que el cliente MQTT confirma su envío.
+
+Con "macro" el lote se publica como un único mensaje (IRCodeBook.encode_macro()) que el
+módulo ESP8266 reproduce con su propia temporización, en este caso la espera se cuenta
+desde el fin de la emisión de cada tecla.
+
+Los mandos se dirigen al equipo configurado en secrets (IR_SITE, IR_ROOM, IR_DEVICE), o al
+equipo "device" ("<cuarto>/<equipo>") del mismo sitio. Con "group" el lote se publica en el
+tópico del grupo (IRCodeBook.group_topic()) y lo emiten todos los equipos del grupo.
+
+Con "zone" el lote se publica en el tópico de la zona (IRCodeBook.zone_topic()), y el
+módulo ESP8266 lo emite por las salidas del microcontrolador asignadas a ella.
+
+Con "at" (seg. desde 1970) la emisión de la primera tecla se programa en ese instante y la
+de las siguientes tras las esperas del lote (IRCodeBook.at()), de manera que los equipos
+de un grupo emiten a la vez, sin la dispersión de la red.
+
+Si el enlace directo (UDP) con el módulo ESP8266 esta configurado en secrets (IRPROXY_HOST,
+UDP_KEY), los mandos se envían por él y solo se recurre al broker si no son confirmados.
+
+Las teclas de IR_URGENT_KEYS en secrets (e.g. ['Audio']) se codifican con prioridad
+(IRCodeBook.urgent_keys()), y el módulo ESP8266 las emite antes que los mandos pendientes.
+
+Por el socket Unix se intercambian los mismos mensajes JSON, uno por línea, con el campo
+adicional "cmd" ("send" o "status").
+"""
+
+import os
+import sys
+import json
+import time
+import queue
+import argparse
+import threading
+import collections
+import socketserver
+from http.server import HTTPServer, BaseHTTPRequestHandler
+import paho.mqtt.client as mqtt
+sys.path.insert(0,'..')
+from secrets import *
+import IRCodeBook
+import IRProxyUDP
+
+# Tópico del equipo al que se dirigen los mandos por omisión :
+TOPIC = IRCodeBook.device_topic(globals())
+
+# Intervalo por omisión entre las teclas de un lote (seg.) :
+DEFAULT_INTERVAL = 0.3
+
+# Número de muestras de latencia conservadas por tecla para las estadísticas :
+LATENCY_SAMPLES = 100
+
+
+class CommandSender(object) :
+  u"""
+  Cola de mandos y la conexión persistente con el broker, los mandos se publican en orden
+  desde un hilo dedicado.
+  """
+
+  def __init__(self, codebook, host, port, transport='tcp', udp_link=None) :
+    self.codebook = codebook
+    self.commands = queue.Queue()
+    self.lock = threading.Lock()
+    self.latency = collections.defaultdict(lambda : collections.deque(maxlen=LATENCY_SAMPLES))
+    self.counters = {'queued' : 0, 'sent' : 0, 'sent_udp' : 0, 'failed' : 0}
+    self.pending = {}
+    self.udp_link = udp_link
+
+    self.client = mqtt.Client(transport=transport)
+    self.client.on_publish = self.on_publish
+    self.client.connect_async(host, port)
+    self.client.loop_start()
+
+    threading.Thread(target=self.run, daemon=True).start()
+
+  def submit(self, keys, interval=DEFAULT_INTERVAL, macro=False, zone=None, device=None,
+             group=None, at=None) :
+    u"""
+    Encola el lote de teclas (como una macro si 'macro') para la zona 'zone' del equipo
+    'device' (o el configurado), o para el grupo 'group', programado en el instante 'at' si
+    no es None. Devuelve la lista de teclas desconocidas (en cuyo caso no se encola ninguna).
+    """
+    # Las teclas del lote se consultan en la tabla vigente, aunque se actualice entretanto :
+    codebook = self.codebook.snapshot() if isinstance(self.codebook, IRCodeBook.LiveCodeBook) \
+               else self.codebook
+    batch = []
+    for k in keys :
+      if isinstance(k, dict) :
+        key, delay = k.get('key'), float(k.get('delay', interval))
+      else :
+        key, delay = k, float(interval)
+      batch.append((key, delay))
+
+    unknown = [key for key, delay in batch if key not in codebook]
+    if unknown :
+      return unknown
+
+    if group :
+      topic = IRCodeBook.group_topic(group, globals())
+    else :
+      device_topic = IRCodeBook.device_topic(globals(), device) if device else TOPIC
+      topic = IRCodeBook.zone_topic(device_topic, zone) if zone \
+              else IRCodeBook.command_topic(device_topic)
+    if macro :
+      gaps = [0] + [int(1e3*delay) for key, delay in batch[:-1]]
+      steps = [(gap, codebook[key]) for gap, (key, delay) in zip(gaps, batch)]
+      label = '+'.join(key for key, delay in batch)
+      payload = IRCodeBook.encode_macro(steps)
+      if at is not None :
+        payload = IRCodeBook.at(payload, at)
+      self.commands.put((label, payload, 0.0, topic))
+    else :
+      for key, delay in batch :
+        payload = codebook[key]
+        if at is not None :
+          payload = IRCodeBook.at(payload, at)
+          at += delay
+        self.commands.put((key, payload, delay, topic))
+    with self.lock :
+      self.counters['queued'] += len(batch)
+
+    return []
+
+  def run(self) :
+    while True :
+      key, payload, delay, topic = self.commands.get()
+      started_at = time.monotonic()
+
+      # El instante de envío se agrega al salir de la cola, para que la espera en ella no
+      # cuente en la vigencia, pero sí la acumulación en el cliente MQTT si el broker no
+      # esta disponible :
+      # El enlace UDP solo alcanza la zona por omisión del equipo configurado :
+      payload = IRCodeBook.stamp(payload)
+      if self.udp_link and topic == IRCodeBook.command_topic(TOPIC) \
+         and self.udp_link.send(payload) :
+        with self.lock :
+          self.latency[key].append(time.monotonic() - started_at)
+          self.counters['sent_udp'] += 1
+      else :
+        self.publish(key, payload, started_at, topic)
+
+      # Espera antes de la siguiente tecla, solo si quedan teclas en la cola :
+      if not self.commands.empty() :
+        time.sleep(delay)
+
+  def publish(self, key, payload, started_at, topic) :
+    u"""
+    Publica el mensaje en el broker, su latencia se registra al confirmarse el envío.
+    """
+    info = self.client.publish(topic, payload)
+    if info.rc != mqtt.MQTT_ERR_SUCCESS :
+      print("Fallo la publicación del código %s" % key)
+      with self.lock :
+        self.counters['failed'] += 1
+    else :
+      with self.lock :
+        self.pending[info.mid] = (key, started_at)
+        # on_publish() pudo ejecutarse antes de registrar el mensaje :
+        if info.is_published() :
+          self.complete(info.mid)
+
+  def on_publish(self, client, userdata, mid) :
+    with self.lock :
+      self.complete(mid)
+
+  def complete(self, mid) :
+    if mid in self.pending :
+      key, started_at = self.pending.pop(mid)
+      self.latency[key].append(time.monotonic() - started_at)
+      self.counters['sent'] += 1
+
+  def status(self) :
+    u"""
+    Devuelve la profundidad de la cola, los contadores y la latencia (mínima, media y
+    máxima, en mseg.) de cada tecla.
+    """
+    with self.lock :
+      latency = {}
+      for key, samples in self.latency.items() :
+        latency[key] = {'n' : len(samples),
+                        'min_ms' : round(1e3*min(samples), 2),
+                        'avg_ms' : round(1e3*sum(samples)/len(samples), 2),
+                        'max_ms' : round(1e3*max(samples), 2)}
+
+      return {'queue_depth' : self.commands.qsize(),
+              'connected' : self.client.is_connected(),
+              'counters' : dict(self.counters),
+              'latency' : latency}
+
+
+def handle(sender, request) :
+  u"""
+  Procesa una solicitud (diccionario) y devuelve la respuesta (diccionario).
+  """
+  if request.get('cmd', 'send') == 'status' :
+    return sender.status()
+
+  keys = request.get('keys')
+  if not isinstance(keys, list) or not keys :
+    return {'error' : 'Se espera la lista de teclas "keys".'}
+
+  unknown = sender.submit(keys, request.get('interval', DEFAULT_INTERVAL),
+                          bool(request.get('macro', False)), request.get('zone'),
+                          request.get('device'), request.get('group'), request.get('at'))
+  if unknown :
+    return {'error' : 'Teclas sin definición.', 'unknown' : unknown}
+
+  return {'queued' : len(keys), 'queue_depth' : sender.commands.qsize()}
+
+
+class HTTPHandler(BaseHTTPRequestHandler) :
+  sender = None
+
+  def reply(self, code, response) :
+    body = json.dumps(response).encode('utf-8')
+    self.send_response(code)
+    self.send_header('Content-Type', 'application/json')
+    self.send_header('Content-Length', str(len(body)))
+    self.end_headers()
+    self.wfile.write(body)
+
+  def do_GET(self) :
+    if self.path == '/status' :
+      self.reply(200, self.sender.status())
+    else :
+      self.reply(404, {'error' : 'Recurso desconocido.'})
+
+  def do_POST(self) :
+    if self.path != '/send' :
+      self.reply(404, {'error' : 'Recurso desconocido.'})
+      return
+
+    try :
+      request = json.loads(self.rfile.read(int(self.headers.get('Content-Length', 0))))
+      if isinstance(request, list) :
+        request = {'keys' : request}
+    except ValueError as e :
+      self.reply(400, {'error' : 'JSON inválido : %s' % e})
+      return
+
+    request['cmd'] = 'send'
+    response = handle(self.sender, request)
+    self.reply(400 if 'error' in response else 200, response)
+
+  def log_message(self, format, *args) :
+    pass
+
+
+class UnixHandler(socketserver.StreamRequestHandler) :
+  sender = None
+
+  def handle(self) :
+    for line in self.rfile :
+      try :
+        response = handle(self.sender, json.loads(line))
+      except ValueError as e :
+        response = {'error' : 'JSON inválido : %s' % e}
+      self.wfile.write((json.dumps(response) + '\n').encode('utf-8'))
+
+
+class ThreadingUnixServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer) :
+  daemon_threads = True
+
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Servicio de mandos de IRProxy.')
+  parser.add_argument('--patterns', default='.', help='Directorio de los archivos XML.')
+  parser.add_argument('--http', default='127.0.0.1:8080', help='Dirección:puerto del interfaz HTTP.')
+  parser.add_argument('--unix', default=None, help='Ruta del socket Unix (opcional).')
+  parser.add_argument('--websockets', action='store_true', help='Conexión al broker por websockets (puerto 9001).')
+  args = parser.parse_args()
+
+  codebook = IRCodeBook.LiveCodeBook(args.patterns, urgent_keys=IRCodeBook.urgent_keys(globals())).watch()
+  print('Libro de códigos : %s' % ', '.join(sorted(codebook)))
+
+  udp_link = IRProxyUDP.open_link(globals())
+  if args.websockets :
+    sender = CommandSender(codebook, MQTT_BROKER, 9001, transport='websockets', udp_link=udp_link)
+  else :
+    sender = CommandSender(codebook, MQTT_BROKER, MQTT_PORT, udp_link=udp_link)
+  HTTPHandler.sender = UnixHandler.sender = sender
+
+  if args.unix :
+    if os.path.exists(args.unix) :
+      os.remove(args.unix)
+    unix_server = ThreadingUnixServer(args.unix, UnixHandler)
+    threading.Thread(target=unix_server.serve_forever, daemon=True).start()
+
+  host, port = args.http.rsplit(':', 1)
+  HTTPServer((host, int(port)), HTTPHandler).serve_forever()
@@ -6,67 +6,43 @@ from kivy.uix.stacklayout import StackLayout
 from kivy.uix.boxlayout import BoxLayout
 from kivy.uix.button import Button
 from kivy.core.window import Window
+from kivy.clock import Clock
 import paho.mqtt.publish as publish
 import sys
 sys.path.insert(0,'..')
 from secrets import *
-
-# Versión del Protocolo de Mando Remoto por  Señales Infrarrojas :
-INFRARED_REMOTE_PROXY_PROTOCOL = 1
+from IRCodeBook import LiveCodeBook, RELOAD_PERIOD, stamp, device_topic, command_topic, urgent_keys
+import IRProxyUDP
 
 # Tamaño inicial de la ventana de la aplicación :
 Window.size = (200, 325)
 
+# Enlace directo (UDP) con el módulo ESP8266, si esta configurado :
+udp_link = IRProxyUDP.open_link(globals())
+
 def MQTTPublish(payload):
   """
   Publica el mensaje, aka. código de la tecla, en el tópico designado (topic), en el broker MQTT (host).
+  Si el enlace directo (UDP) esta configurado se prefiere, recurriendo al broker solo si falla.
   """
+  # El mensaje lleva el instante de envío, para que no se emita si llega tarde :
+  payload = stamp(payload)
+
+  if udp_link and udp_link.send(payload) :
+    print("Enviando (UDP) : %s" % payload)
+    return
+
   host = MQTT_BROKER
   port = 9001
 
-  topic = "ir_proxy/deco_tv"
+  # Tópico de los mensajes del equipo configurado en secrets (IR_SITE, IR_ROOM, IR_DEVICE) :
+  topic = command_topic(device_topic(globals()))
   try :
     publish.single(topic, payload, hostname = host, port = port, transport='websockets')
     print("Enviando : %s" % payload)
   except :
     print("Fallo la publicación del código")
 
-def encode(file):
-    u"""
-    Devuelve el código del patrón definido en el archivo XML 'file'.
-    """
-    import xml.etree.ElementTree as etree
-
-    # Lee e interpreta el archivo de definición ...
-    xml_root = etree.parse(file).getroot()
-
-    source = xml_root.find('SOURCE').text.strip()
-
-    id = xml_root.find('ID').text.strip()
-
-    xml_carrier = xml_root.find('CARRIER')
-    unit_val, time_unit = xml_carrier.attrib['unit'].strip().split()
-    carrier = {"unit" : {'value' : float(unit_val), 'time_unit' : time_unit},
-               "period" : int(xml_carrier.find('PERIOD').text.strip()) ,
-               "duty_cycle" : int(xml_carrier.find('DUTY_CYCLE').text.strip())}
-
-    xml_pattern = xml_root.find('PATTERN')
-
-    pattern = {"unit" : xml_pattern.attrib["unit"].strip(), "pulse" : [] }
-    for p in xml_pattern :
-      pattern["pulse"].append(dict(high=int(p.find('HIGH').text.strip()), low=int(p.find('LOW').text.strip())))
-
-    # para generar el código del patron de la tecla :
-    s = encode_num(INFRARED_REMOTE_PROXY_PROTOCOL)
-    s += encode_num(len(pattern["pulse"]))
-    s += encode_num(carrier['period'])
-    s = s + encode_num(carrier['duty_cycle'])
-    for p in pattern['pulse'] :
-      s = s + encode_num(p['high']) + encode_num(p['low'])
-
-    return s
-
-
 class IRButton(Button):
   u"""
   Clase descendiente de Button, utilizada para representar las teclas del control remoto y asociar el método
@@ -75,8 +51,9 @@ class IRButton(Button):
 
   def on_press(self):
     print("Presionado : %s, " % self.text , end='')
-    if self.text in buttons_code.keys() :
-      MQTTPublish(buttons_code[self.text])
+    code = codebook.get(buttons_key.get(self.text))
+    if code is not None :
+      MQTTPublish(code)
       print(self.pos)
 
     else :
@@ -101,36 +78,22 @@ class IRProxyApp(App):
     return IRProxy()
 
 
-def encode_num(num) :
-  """
-  Devuelve el código correspondiente al número 'num'
-  """
-  if type(num) == int :
-    s = ''
-    while num > 0 :
-      if num > 127 :
-        s += '{:02X}'.format(int(128 + (num % 128)))
-      else :
-        s += '{:02X}'.format(int(num % 128))
-      num //= 128
-    return s
-
-  raise TypeError('encode_num solo codifica números enteros.')
-
-
 if __name__ == '__main__':
-  # Correspondencia entre los nombres (texto) de las teclas y la definición de su patrón :
-  # buttons_code = {'+CH' : encode('+CH.xml')}
-  buttons_code = {'+CH'  : encode('CH_PLUS.xml') , '-CH' : encode('CH-Minus.xml'),
-                  '+VOL' : encode('Vol-Plus.xml'), '-VOL' : encode('Vol-Minus.xml'),
-                  '1'    : encode('K1.xml'), '2'   : encode('K2.xml'), '3'   : encode('K3.xml'),
-                  '4'    : encode('K4.xml'), '5'   : encode('K5.xml'), '6'   : encode('K6.xml'),
-                  '7'    : encode('K7.xml'), '8'   : encode('K8.xml'), '9'   : encode('K9.xml'),
-                  '0'    : encode('K0.xml'),
-                  'GUIDE': encode('Guide.xml') , 'INFO'   : encode('Info.xml'),
-                  'BACK' : encode('Back.xml')  , 'AUDIO'  : encode('Audio.xml'),
-                  'UP'   : encode('Up.xml')    , 'LEFT'   : encode('Left.xml'),
-                  }
-  print('+CH: ', buttons_code['+CH'])
+  # Correspondencia entre los nombres (texto) de las teclas y la identificación (ID) de su
+  # patrón en el libro de códigos, que se actualiza con los cambios de los archivos XML sin
+  # reiniciar la aplicación :
+  buttons_key = {'+CH'  : 'CH_PLUS' , '-CH'   : 'CH-Minus' ,
+                 '+VOL' : 'Vol-Plus', '-VOL'  : 'Vol-Minus',
+                 '1'    : 'K1', '2'   : 'K2', '3'   : 'K3',
+                 '4'    : 'K4', '5'   : 'K5', '6'   : 'K6',
+                 '7'    : 'K7', '8'   : 'K8', '9'   : 'K9',
+                 '0'    : 'K0',
+                 'GUIDE': 'Guide'   , 'INFO'  : 'Info'     ,
+                 'BACK' : 'Back'    , 'AUDIO' : 'Audio'    ,
+                 'UP'   : 'Up'      , 'LEFT'  : 'Left'     ,
+                 }
+  codebook = LiveCodeBook('.', urgent_keys=urgent_keys(globals()))
+  Clock.schedule_interval(lambda dt : codebook.reload(), RELOAD_PERIOD)
+  print('+CH: ', codebook.get('CH_PLUS'))
   # Aplicación de Kivy :
   IRProxyApp().run()
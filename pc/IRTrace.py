@@ -0,0 +1,160 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Lectura e interpretación del registro de eventos del microcontrolador (ver "Registro de
+Eventos" en uC/IRProxy_uC.c), para diagnosticar los cebados y las demoras sin depurador.
+
+El módulo ESP8266 publica el registro, en hexadecimal, en el tópico del equipo seguido de
+'/trace' al recibir la solicitud IRCodeBook.encode_trace(). El contenido es :
+
+  [Longitud] [head] [count] [ticks (2 bytes)] y TRACE_SIZE entradas de 5 bytes :
+  [Evento] [Argumento] [Tick (2 bytes)] [Fracción del tick]
+
+  python IRTrace.py              solicita el registro por el broker y lo muestra.
+  python IRTrace.py --device sala/tv   ídem, del equipo indicado (del sitio de secrets).
+  python IRTrace.py 9F0A0A...    muestra el registro indicado.
+"""
+
+import sys
+import time
+import struct
+import argparse
+sys.path.insert(0,'..')
+
+import IRCodeBook
+
+# Base de tiempos del microcontrolador : TICK_PERIOD seg. y la fracción en cuentas de
+# LFINTOSC/16 :
+TICK_PERIOD = 0.1
+SUBTICK_PERIOD = 16 / 31e3
+
+HEADER = struct.Struct('<BBBH')
+ENTRY = struct.Struct('<BBHB')
+
+EVENTS = {0x01 : 'reset', 0x02 : 'stage', 0x03 : 'frame_start', 0x04 : 'frame_end',
+          0x05 : 'parse_error', 0x06 : 'clearance', 0x07 : 'keepalive', 0x08 : 'restart'}
+
+ERRORS = {0x01 : 'timeout', 0x02 : 'overflow', 0x03 : 'number', 0x04 : 'unknown_id',
+          0x05 : 'payload'}
+
+RESTARTS = {0x01 : 'keepalive_timeout', 0x02 : 'ir_inactivity', 0x03 : 'esp8266_request',
+            0x04 : 'bad_stage'}
+
+STAGES = {0 : 'STARTUP_EXTENDED_DELAY', 1 : 'PS_STARTUP_DELAY', 2 : 'PS_STARTUP',
+          3 : 'EPS_STARTUP_DELAY', 4 : 'EPS_STARTUP', 5 : 'PROXY'}
+
+# Bits de PCON (PIC16F1619), activos en bajo salvo STKOVF y STKUNF :
+RESET_CAUSES = ((0x80, 1, 'stack_overflow'), (0x40, 1, 'stack_underflow'),
+                (0x20, 0, 'wdt_window'), (0x10, 0, 'wdt'), (0x08, 0, 'mclr'),
+                (0x04, 0, 'reset_instruction'), (0x02, 0, 'power_on'), (0x01, 0, 'brown_out'))
+
+
+def reset_cause(pcon) :
+  causes = [name for mask, active, name in RESET_CAUSES if bool(pcon & mask) == bool(active)]
+  # En el arranque en frío los demás bits no son válidos :
+  if 'power_on' in causes :
+    return ['power_on']
+  return causes
+
+
+def describe(event, arg) :
+  u"""
+  Devuelve la descripción del argumento 'arg' del evento 'event'.
+  """
+  if event == 0x01 :
+    return '+'.join(reset_cause(arg)) or 'pcon=0x%02X' % arg
+  if event == 0x02 :
+    return STAGES.get(arg, str(arg))
+  if event == 0x03 :
+    return 'id=0x%02X' % arg
+  if event == 0x04 :
+    return '%d bytes' % arg
+  if event == 0x05 :
+    return ERRORS.get(arg, str(arg))
+  if event == 0x06 :
+    return '%d bytes descartados' % arg
+  if event == 0x07 :
+    return 'x%d' % arg
+  if event == 0x08 :
+    return RESTARTS.get(arg, str(arg))
+  return str(arg)
+
+
+def decode(code) :
+  u"""
+  Devuelve la lista de eventos (del más antiguo al más reciente) del registro 'code'
+  (hexadecimal o bytes), cada uno como el diccionario {'time', 'event', 'arg', 'info'},
+  donde time es el instante en seg. desde la inicialización del registro.
+  """
+  data = bytes.fromhex(code) if isinstance(code, str) else bytes(code)
+  size, head, count, ticks = HEADER.unpack_from(data)
+  if size != len(data) or (size - HEADER.size) % ENTRY.size :
+    raise ValueError('El registro no tiene la longitud esperada.')
+
+  num_entries = (size - HEADER.size) // ENTRY.size
+  first = (head - count) % num_entries
+  events = []
+  for n in range(count) :
+    offset = HEADER.size + ENTRY.size * ((first + n) % num_entries)
+    event, arg, tick, sub = ENTRY.unpack_from(data, offset)
+    events.append({'time' : round(tick * TICK_PERIOD + sub * SUBTICK_PERIOD, 4),
+                   'event' : EVENTS.get(event, 'event_0x%02X' % event),
+                   'arg' : arg, 'info' : describe(event, arg)})
+
+  return events
+
+
+def timeline(events) :
+  u"""
+  Devuelve el texto de la secuencia de eventos, con el tiempo desde el evento anterior,
+  los arranques se separan para distinguir cada periodo de operación.
+  """
+  lines, last = [], None
+  for e in events :
+    if e['event'] == 'reset' :
+      lines.append('-' * 60)
+    delta = '' if last is None else '%+9.4f' % (e['time'] - last)
+    lines.append('%10.4f %s  %-12s %s' % (e['time'], delta.rjust(9), e['event'], e['info']))
+    last = e['time']
+
+  return '\n'.join(lines)
+
+
+def request(host, port, topic, timeout=5.0) :
+  u"""
+  Solicita el registro al módulo ESP8266 del tópico 'topic' (IRCodeBook.device_topic()) por
+  el broker y devuelve el publicado, o None.
+  """
+  import paho.mqtt.client as mqtt
+
+  received = []
+  client = mqtt.Client()
+  client.on_message = lambda c, u, msg : received.append(msg.payload.decode())
+  client.connect(host, port)
+  client.subscribe(topic + IRCodeBook.TRACE_SUBTOPIC)
+  client.loop_start()
+  client.publish(IRCodeBook.command_topic(topic), IRCodeBook.encode_trace())
+  deadline = time.monotonic() + timeout
+  while not received and time.monotonic() < deadline :
+    time.sleep(0.05)
+  client.loop_stop()
+  client.disconnect()
+
+  return received[0] if received else None
+
+
+if __name__ == '__main__' :
+  parser = argparse.ArgumentParser(description='Registro de eventos del microcontrolador.')
+  parser.add_argument('code', nargs='?', help='Registro (hexadecimal), si no se solicita.')
+  parser.add_argument('--device', default=None, help='Equipo (<cuarto>/<equipo>).')
+  args = parser.parse_args()
+
+  code = args.code
+  if code is None :
+    from secrets import *
+    code = request(MQTT_BROKER, MQTT_PORT, IRCodeBook.device_topic(globals(), args.device))
+    if code is None :
+      sys.exit('No se recibió el registro de eventos.')
+
+  print(timeline(decode(code)))
@@ -9,7 +9,8 @@ def on_connect(client, userdata, flags, rc):
 
     # Subscribing in on_connect() means that if we lose the connection and
     # reconnect then subscriptions will be renewed.
-    client.subscribe("ir_proxy/deco_tv")
+    # Todos los tópicos de todos los equipos (mensajes, estado, patrones aprendidos, ...) :
+    client.subscribe("ir_proxy/#")
 
 # The callback for when a PUBLISH message is received from the server.
 def on_message(client, userdata, msg):
@@ -94,6 +94,30 @@
  *
  * La Versión del Protocolo, es 0x01 para el mando de control infrarrojo.
  *
+ * La versión 0x02 agrega, después del número de pulsos, la máscara de opciones (1 byte),
+ * cada opción activa agrega un número (de hasta 2 bytes) después del periodo activo de
+ * la portadora, en el orden de sus bits :
+ *  [0x02] [Pulsos] [Opciones] [Periodo] [Periodo Activo] [Opción 0] ... [Opción 6]
+ *   Bit 0 (PATTERN_OPT_TIME_BASE) : Base de tiempo, la duración de cada parte del pulso
+ *                                   se expresa en múltiplos de este número de ciclos de la
+ *                                   portadora, de manera que la mayoría se codifican en
+ *                                   un byte.
+ *   Bit 1 (PATTERN_OPT_OUTPUTS)   : Máscara de las salidas (emisores) por las que se
+ *                                   emite el patrón, por omisión solo la primera (RA0).
+ *                                   Si no selecciona ninguna salida disponible el patrón
+ *                                   no se emite.
+ *   Bit 2 (PATTERN_OPT_DELAY)     : Demora del inicio de la emisión, en las unidades de
+ *                                   la duración de los pulsos (base de tiempo), que se
+ *                                   cuenta con la portadora desconectada. El módulo
+ *                                   ESP8266 la utiliza para iniciar la emisión en un
+ *                                   instante preciso (emisión programada). Solo demora
+ *                                   la primera emisión, no sus repeticiones.
+ *   Bit 3 (PATTERN_OPT_PRIORITY)  : Prioridad, si no es 0 el patrón es urgente (e.g. 
+ *                                   POWER o MUTE) : cancela las repeticiones pendientes
+ *                                   (REPEAT_ID) del patrón en emisión, que termina la 
+ *                                   repetición en curso, de manera que la demora de su
+ *                                   emisión es acotada.
+ *
  * Los números son codificados de la siguiente manera, se N el valor numérico :
  *    N <= 127           : 1 Byte, con el valor del Número N
  *    0x3FFF >= N >= 128 : 2 Bytes, byte LSB = 0x80 + (N % 128)
@@ -120,6 +144,17 @@
  *    0x7E : Mensaje de solicitud de cebado (RESETREQ_ID).
  * 
  * En ambos casos deben ser eguidos por un byte con el valor 0x00 (i.e. sin carga/payload).
+ *
+ *    0x7A : Repetición del último patrón : [0x7A] [Veces] [Verificación] (ver "Despacho
+ *           de Mensajes").
+ *    0x7B : Solicitud de aprendizaje de un patrón (LEARN_ID), solo en el PIC16F1619 :
+ *             [0x7B] [Tamaño de la carga] [Periodo de la portadora] [Periodo Activo]
+ *           el patrón capturado se devuelve por el SPI, precedido por el byte 0xA5, con el
+ *           formato descrito arriba (ver "Aprendizaje de Patrones").
+ *    0x79 : Solicitud del registro de eventos (TRACE_ID), solo en el PIC16F1619 : 
+ *             [0x79] [0x00]
+ *           el registro se devuelve por el SPI, precedido por el byte 0x5A (ver "Registro
+ *           de Eventos").
 */
 
 #if __16F18313
@@ -193,6 +228,7 @@
 #include <xc.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "../codec/vlq.h"
 
 
 /* Oscilador(es) del microcontrolador :
@@ -219,6 +255,22 @@
 #define PPS_CCP1OUT             (0b01100)
 #define IR_PWM_PPS              RA0PPS
 
+// Emisores adicionales, cada patrón selecciona las salidas por las que se emite (la
+// portadora de CCP1 se asigna a cada una por PPS). La placa con el PIC16F18313 no dispone
+// de terminales libres, por lo que solo la maqueta con el PIC16F1619 tiene un segundo
+// emisor (en RC5) :
+#if __16F1619
+  #define IR_OUTPUTS            (2)
+
+  #define TRIS_IR2_PWM          TRISCbits.TRISC5
+  #define ANSEL_IR2_PWM         ANSELCbits.ANSC5
+  #define LAT_IR2_PWM           LATCbits.LATC5
+  #define IR2_PWM_PPS           RC5PPS
+#else
+  #define IR_OUTPUTS            (1)
+#endif
+#define IR_OUTPUTS_MASK         ((1 << IR_OUTPUTS) - 1)
+
 // Interfaz SPI (solo SCK y SDI) :
 #define TRIS_SDI                TRISAbits.TRISA1
 #define ANSEL_SDI               ANSELAbits.ANSA1
@@ -233,6 +285,31 @@
 #define ANSEL_ESP8266_RST       ANSELAbits.ANSA4
 #define LAT_ESP8266_RST         LATAbits.LATA4
 
+// Receptor infrarrojo (demodulado) y salida SDO del SPI, utilizados en el modo de 
+// aprendizaje. La placa con el PIC16F18313 no dispone de terminales libres para ambos,
+// por lo que el modo de aprendizaje solo se incluye en la maqueta con el PIC16F1619 :
+#if __16F1619
+  #define LEARN_SUPPORT         (1)
+
+  #define TRIS_IR_RCVR          TRISCbits.TRISC3
+  #define ANSEL_IR_RCVR         ANSELCbits.ANSC3
+  #define PPS_IR_RCVR           (0b10011)           /* RC3 */
+
+  #define TRIS_SDO              TRISCbits.TRISC7
+  #define ANSEL_SDO             ANSELCbits.ANSC7
+  #define PPS_SDO               (0b10010)
+  #define SDO_PPS               RC7PPS
+#else
+  #define LEARN_SUPPORT         (0)
+#endif
+
+// El registro de eventos solo se incluye donde puede devolverse (por la salida SDO) :
+#if __16F1619
+  #define TRACE_SUPPORT         (1)
+#else
+  #define TRACE_SUPPORT         (0)
+#endif
+
 #if __16F1619 
   #undef ANSEL_SD_PWM
   uint8_t fake_ansel ;
@@ -250,6 +327,105 @@
 */
 
 
+/** Registro de Eventos ****************************************************************/
+
+/* Para diagnosticar los cebados y las demoras sin un depurador, los eventos se registran
+ * en un buffer circular (trace) en la memoria persistente, que sobrevive a los cebados en
+ * caliente (asm("RESET"), el guardián, etc.) y se devuelve por el SPI con la solicitud 
+ * TRACE_ID : [TRACE_SYNC] seguido de trace a partir de su campo size (la longitud de lo
+ * devuelto), i.e. [size] [head] [count] [ticks] y las TRACE_SIZE entradas (la más antigua
+ * es entry[head] si el buffer esta lleno). Los números de 16 bits son little-endian.
+ *
+ * Cada entrada contiene el evento, su argumento y el instante : ticks (de TICK_PERIOD,
+ * contados desde que el registro se inicializó, sin el tiempo de espera de los cebados) y
+ * la fracción del tick en cuentas del temporizador de la base de tiempos (LFINTOSC/16, 
+ * i.e. 0.5 mSeg.). Los mensajes de verificación (KEEPALIVE_ID) consecutivos se acumulan en
+ * una sola entrada, cuyo argumento es su número (y el instante el del último).
+ *
+ * Sin TRACE_SUPPORT, Trace() no genera código.
+*/
+#define TRACE_RESET            (0x01)   /* Arranque, arg. : PCON (causa del cebado).     */
+#define TRACE_STAGE            (0x02)   /* Cambio de etapa, arg. : etapa de main().      */
+#define TRACE_FRAME_START      (0x03)   /* Inicio de un mensaje, arg. : identificación.  */
+#define TRACE_FRAME_END        (0x04)   /* Fin de su proceso, arg. : longitud.           */
+#define TRACE_PARSE_ERROR      (0x05)   /* Mensaje incorrecto, arg. : TRACE_ERR_x.       */
+#define TRACE_CLEARANCE        (0x06)   /* Fin de la espera, arg. : bytes descartados.   */
+#define TRACE_KEEPALIVE        (0x07)   /* arg. : número de mensajes consecutivos.       */
+#define TRACE_RESTART          (0x08)   /* Auto-cebado, arg. : TRACE_RESTART_x.          */
+
+#define TRACE_ERR_TIMEOUT      (0x01)   /* Se excedió el tiempo entre bytes.             */
+#define TRACE_ERR_OVERFLOW     (0x02)   /* Se excedió la longitud del mensaje.           */
+#define TRACE_ERR_NUMBER       (0x03)   /* Número con más bytes que los admitidos.       */
+#define TRACE_ERR_UNKNOWN      (0x04)   /* Identificación desconocida.                   */
+#define TRACE_ERR_PAYLOAD      (0x05)   /* Carga inesperada.                             */
+
+#define TRACE_RESTART_KEEPALIVE   (0x01) /* Cesaron los mensajes del módulo.             */
+#define TRACE_RESTART_INACTIVITY  (0x02) /* Cesaron los patrones.                        */
+#define TRACE_RESTART_REQUEST     (0x03) /* Solicitud del módulo (RESETREQ_ID).          */
+#define TRACE_RESTART_STAGE       (0x04) /* Etapa desconocida en main().                 */
+
+uint8_t rcve_error ;
+
+#if TRACE_SUPPORT
+
+#define TRACE_SIZE             (32)     /* Potencia de 2. */
+#define TRACE_VALID_KEY        (0x6C)
+#define TRACE_SUBTICK          TMR6
+
+typedef struct {
+  uint8_t  event, arg ;
+  uint16_t tick ;
+  uint8_t  sub ;
+} trace_entry_t ;
+
+__persistent struct {
+  uint8_t  validation_key ;
+  uint8_t  size ;
+  uint8_t  head, count ;
+  uint16_t ticks ;
+  trace_entry_t entry[TRACE_SIZE] ;
+} trace ;
+
+
+void Trace(uint8_t event, uint8_t arg) {
+trace_entry_t *e ;
+  e = &trace.entry[(trace.head - 1) & (TRACE_SIZE - 1)] ;
+  if ((event == TRACE_KEEPALIVE) && trace.count && (e->event == TRACE_KEEPALIVE)) {
+    // Se acumula en la entrada del mensaje anterior :
+    if (e->arg != 0xFF) e->arg++ ;
+  }
+  else {
+    e = &trace.entry[trace.head] ;
+    e->event = event ; e->arg = arg ;
+    trace.head = (trace.head + 1) & (TRACE_SIZE - 1) ;
+    if (trace.count < TRACE_SIZE) trace.count++ ;
+  }
+
+  e->tick = trace.ticks ;
+  e->sub  = TRACE_SUBTICK ;
+}
+
+
+/* Valida el registro (se inicializa en el arranque en frío) y registra la causa del 
+   arranque, que luego se borra (los bits nXXX se activan y STKOVF/STKUNF se borran) :
+*/
+void Trace_init(void) {
+  if (trace.validation_key != TRACE_VALID_KEY) {
+    trace.validation_key = TRACE_VALID_KEY ;
+    trace.head = 0 ; trace.count = 0 ; trace.ticks = 0 ;
+  }
+  trace.size = sizeof(trace) - 1 ;
+
+  Trace(TRACE_RESET, PCON) ;
+  PCON = 0x3F ;
+}
+
+#else
+  #define Trace_init()
+  #define Trace(event, arg)
+#endif
+
+
 /** Base de Tiempos ********************************************************************/
 
 /* TICK_PERIOD es la unidad de tiempo utilizada para medir el tiempo en la secuencia de 
@@ -309,6 +485,9 @@ int16_t tick_cnt ;
     if (PIR2bits.TMR6IF) {
       PIR2bits.TMR6IF = 0 ;
       ++tick_cnt ;
+      #if TRACE_SUPPORT
+        ++trace.ticks ;
+      #endif
       asm("CLRWDT") ;
     }
   }
@@ -334,7 +513,8 @@ int16_t tick_cnt ;
  * 
  * El microcontrolador debe esperar hasta que la tensión a la salida alcance su nivel 
  * estable para iniciar la generación de la señal PWM que sirve de excitación para el
- * pre-regulador (> 0.5 seg).
+ * pre-regulador. La condición se verifica midiendo VDD (ver el Supervisor de la Tensión
+ * de Alimentación), en lugar de esperar un tiempo fijo.
  * 
  * El ciclo de trabajo del pre-regulador se calcula para obtener la tensión mínima de 
  * regulación (4.8v) del regulador lineal, a la tensión de entrada del adaptador de 
@@ -412,7 +592,96 @@ int16_t tick_cnt ;
   void SDPWM_start(void) { }
 
 #endif
-  
+
+
+/** Supervisor de la Tensión de Alimentación *******************************************/
+
+/* En lugar de esperar tiempos fijos durante el arranque, se mide la tensión de alimen-
+ * tación del microcontrolador (VDD) para decidir cuando avanzar a la siguiente etapa.
+ *
+ * La medición se realiza con el ADC, convirtiendo la salida de la referencia interna
+ * (FVR = 1.024V) utilizando VDD como referencia del propio ADC, por lo cual :
+ *
+ *   VDD = FVR_VOLTAGE * 1023 / ADRES
+ *
+ * Para evitar la división en tiempo de ejecución, la condición VDD >= VDD_REGULATION_MIN
+ * se evalúa en forma equivalente como ADRES <= VDD_REGULATION_COUNT.
+ *
+ * La tensión se considera en regulación cuando se mantiene sobre VDD_REGULATION_MIN al
+ * menos durante VDD_STABLE_TIME, de manera de descartar los transitorios del arranque
+ * del pre-regulador. Si la condición no se cumple antes de VDD_STARTUP_TIMEOUT se avanza
+ * de todas maneras (comportamiento equivalente al de las esperas fijas anteriores).
+*/
+#define FVR_VOLTAGE                    ( 1.024) /* Voltios  */
+#define VDD_REGULATION_MIN             ( 3.15 ) /* Voltios  */
+#define VDD_REGULATION_COUNT           ((uint16_t)(FVR_VOLTAGE * 1023 / VDD_REGULATION_MIN))
+#define VDD_STABLE_TIME                ( 0.2  ) /* seg.     */
+#define VDD_STARTUP_TIMEOUT            ( 1.0  ) /* seg. (tick_cnt > 10 : 1.1 seg., la espera fija anterior) */
+
+#if __16F18313
+  #define ADC_FVR_CHANNEL              (0b111111)
+#elif __16F1619
+  #define ADC_FVR_CHANNEL              (0b11111)
+#endif
+
+int16_t vdd_stable_tick ;
+
+void VddMonitor_init(void) {
+  // Habilita la referencia interna para el ADC con la ganancia 1x (1.024V) :
+  FVRCONbits.ADFVR = 0b01 ;
+  FVRCONbits.FVREN = 1    ;
+
+  // El ADC utiliza VDD como referencia y convierte la salida de la FVR :
+  ADCON1bits.ADFM   = 1      ; // Justificación a la derecha (ADRES = 0 .. 1023).
+  ADCON1bits.ADCS   = 0b010  ; // Reloj de conversión FOSC/32 (1 uS).
+  ADCON1bits.ADPREF = 0b00   ; // Referencia positiva = VDD.
+  ADCON0bits.CHS    = ADC_FVR_CHANNEL ;
+  ADCON0bits.ADON   = 1      ;
+}
+
+
+/* Reinicia la cuenta del tiempo en regulación, debe invocarse al iniciar cada espera :
+*/
+void VddMonitor_rearm(void) {
+  vdd_stable_tick = tick_cnt ;
+}
+
+
+/* Devuelve true si la tensión de alimentación se mantuvo en regulación al menos
+   durante VDD_STABLE_TIME, debe invocarse continuamente durante la espera :
+*/
+bool VddMonitor_isStable(void) {
+  // Espera que la referencia este lista para realizar la conversión :
+  if (!FVRCONbits.FVRRDY) {
+    vdd_stable_tick = tick_cnt ;
+    return false ;
+  }
+
+#if __16F18313
+  ADCON0bits.GOnDONE = 1 ;
+  while (ADCON0bits.GOnDONE) continue ;
+#elif __16F1619
+  ADCON0bits.GO_nDONE = 1 ;
+  while (ADCON0bits.GO_nDONE) continue ;
+#endif
+
+  if (ADRES > VDD_REGULATION_COUNT) {
+    // La tensión esta por debajo del nivel de regulación, se reinicia la cuenta :
+    vdd_stable_tick = tick_cnt ;
+    return false ;
+  }
+
+  return ((tick_cnt - vdd_stable_tick) >= (int16_t)(VDD_STABLE_TIME/TICK_PERIOD)) ;
+}
+
+
+/* Apaga el ADC y la referencia, pues no se utilizan después del arranque :
+*/
+void VddMonitor_stop(void) {
+  ADCON0bits.ADON  = 0 ;
+  FVRCONbits.FVREN = 0 ;
+}
+
 /** Supervisor del Módulo ESP8266 ******************************************************/
 
 /* La operación del módulo ESP8266 se superviza indirectamente, por medio de varios 
@@ -524,10 +793,12 @@ void ESP8266Watchdog_task(void) {
   }
   
   if (irInactive_tmr >= ((uint32_t)IR_INACTIVE_TIMEOUT * 3600)) {
+      Trace(TRACE_RESTART, TRACE_RESTART_INACTIVITY) ;
       ESP8266Watchdog_restart() ;
   }
   
   if (keepalive_tmr >= ((int16_t)KEEPALIVE_TIMEOUT)) {
+      Trace(TRACE_RESTART, TRACE_RESTART_KEEPALIVE) ;
       ESP8266Watchdog_reset() ;
   }
   
@@ -540,7 +811,16 @@ void ESP8266Watchdog_task(void) {
 */
 #define KEEPALIVE_ID                        (0x7F)
 #define RESETREQ_ID                         (0x7E)
+#define LEARN_ID                            (0x7B)
+#define TRACE_ID                            (0x79)
+#define TRACE_SYNC                          (0x5A)
+#define REPEAT_ID                           (0x7A)
 #define INFRARED_REMOTE_PROXY_PROTOCOL      (01)
+#define INFRARED_REMOTE_PROXY_PROTOCOL_2    (02)
+#define PATTERN_OPT_TIME_BASE               (0x01)
+#define PATTERN_OPT_OUTPUTS                 (0x02)
+#define PATTERN_OPT_DELAY                   (0x04)
+#define PATTERN_OPT_PRIORITY                (0x08)
 #define MAX_NUMBER_OF_PULSES    (17)
 
 /* Alias de los SFR (CCP1 y TMR2) utilizados para la generción de patrones :
@@ -551,36 +831,63 @@ void ESP8266Watchdog_task(void) {
 #define T2CONbits_CKPS           T2CONbits.T2CKPS
 #define T2CONbits_OUTPS          T2CONbits.T2OUTPS
 
-/* Memoria de Contención de la definición del patrón :
+/* Memoria de Contención de los patrones : cada mensaje se recibe en uno de dos bancos
+   (ping-pong), irCodeRX apunta al de recepción. Al iniciar la emisión de un patrón su 
+   banco se cede a la interrupción (irCodeTX.bank) y la recepción continúa en el otro, de 
+   manera que el siguiente mensaje se recibe mientras el patrón se emite. El intercambio 
+   se realiza solo con la emisión detenida (TMR2IE = 0), cuando la interrupción no accede a
+   los bancos, por lo que es atómico.
+
+   irCodeTX solo conserva la cabecera, decodificada, del patrón en emisión : 
 */
-typedef union {
-  struct {
-    uint8_t num_pulses ;
+#define PATTERN_BANK_SIZE        (VLQ_PATTERN_SIZE)
+#define REPEAT_NONE              (0x80)   /* Verificación imposible, no hay patrón. */
 
-    struct {
-      uint16_t period, duty_cycle ;
-    } carrier ;
+typedef struct {
+  uint8_t num_pulses ;
+
+  struct {
+    uint16_t period, duty_cycle ;
+  } carrier ;
 
-    /*
-    struct {
-        uint8_t idx ;
-        uint8_t buffer[40] ;
-    } pulse ;
-    */
-  } ;
+  uint8_t  time_base ;
+  uint8_t  outputs ;
+  uint16_t delay ;
 
-  uint8_t byte[46] ;
+  uint8_t  *bank ;                        // Banco del patrón, ...
+  uint8_t  pulses ;                       // índice de su primer pulso, ...
+  uint8_t  rd ;                           // de lectura (en la interrupción) y ...
+  uint8_t  check ;                        // verificación para su repetición (REPEAT_ID).
 } ir_code_t ;
 
-/* TO DO : IRCodeTX no tiene que ser del tamaño de ir_code_t */
 ir_code_t irCodeTX ;
 
-uint8_t irCodeRX[sizeof(ir_code_t)] ;
+uint8_t irCodeBank[2][PATTERN_BANK_SIZE] ;
+uint8_t *irCodeRX ;
+
+/* Índices de escritura (recepción) y lectura (decodificación) del banco irCodeRX :
+*/
+struct {
+  uint8_t rd, wr ;
+} pattern_idx ;
+
 uint16_t ReadNumber(void) ;
-uint16_t ReadNumber_copy(void) ;
+uint16_t ReadPulse(void) ;
+
+
+uint8_t pattern_pulseCnt, carrier_cycleCnt, time_baseCnt ;
+uint16_t delayCnt ;
 
+// Repeticiones pendientes del patrón en emisión (REPEAT_ID), la interrupción las inicia
+// una tras otra sin intervención de la tarea de fondo, que las cancela (patrón urgente) :
+volatile uint8_t repeatCnt ;
 
-uint8_t pattern_pulseCnt, carrier_cycleCnt ;
+// Asignación (PPS) de cada salida durante los periodos activos, PPS_CCP1OUT si la salida
+// está seleccionada, de otra forma 0 (i.e. desconectada) :
+uint8_t ir_pwm_pps ;
+#if IR_OUTPUTS > 1
+uint8_t ir2_pwm_pps ;
+#endif
 
 
 bool IRCodeHasEnded(void) {
@@ -589,8 +896,8 @@ bool IRCodeHasEnded(void) {
   // se esta generando un patrón, precisamente las interrupciones se habilitan
   // cuando se esta generando un patrón y des-habilitan cuando el generador esta
   // en reposo, por lo cual se puede utilizar como indicador para determinar que 
-  // la generación termino y/o esta en reposo :
-  return (unsigned)(PIE1bits.TMR2IE == 1) ;
+  // la generación termino y/o esta en reposo (interrupción des-habilitada) :
+  return (unsigned)(PIE1bits.TMR2IE == 0) ;
 }
 
 
@@ -600,21 +907,53 @@ void IRCodeTask(void) {
   if (PIR1bits.TMR2IF) {
     PIR1bits.TMR2IF = 0 ;
 
+    // Cada unidad de la duración de los pulsos equivale a time_base ciclos de la portadora :
+    if (--time_baseCnt != 0) return ;
+    time_baseCnt = irCodeTX.time_base ;
+
+    // Demora previa al primer pulso (PATTERN_OPT_DELAY), con la portadora desconectada :
+    if (delayCnt != 0) {
+      if (--delayCnt == 0) {
+        IR_PWM_PPS  = ir_pwm_pps ;
+        #if IR_OUTPUTS > 1
+          IR2_PWM_PPS = ir2_pwm_pps ;
+        #endif
+      }
+      return ;
+    }
+
     if (--carrier_cycleCnt == 0) {
       carrier_cycleCnt = 0 ;
 
       if (++pattern_pulseCnt >= (uint8_t)(irCodeTX.num_pulses << 1)) {
+        if (repeatCnt != 0) {
+          // Inicia la siguiente repetición del patrón, desde su primer pulso (sin la
+          // demora, que solo precede a la primera emisión) :
+          repeatCnt-- ;
+          pattern_pulseCnt = 0 ;
+          irCodeTX.rd = irCodeTX.pulses ;
+          carrier_cycleCnt = ReadPulse() ;
+          IR_PWM_PPS  = ir_pwm_pps ;
+          #if IR_OUTPUTS > 1
+            IR2_PWM_PPS = ir2_pwm_pps ;
+          #endif
+          return ;
+        }
+
         // Apaga el generador PWM (aka. el móduo CCP1)  y la salida :
         T2CONbits.TMR2ON     = 0      ;
         CCP1CONbits.CCP1MODE = 0b0000 ;
         LAT_IR_PWM = 1 ;
+        #if IR_OUTPUTS > 1
+          LAT_IR2_PWM = 1 ;
+        #endif
 
         // Señaliza que la generación del patrón termino :
         PIE1bits.TMR2IE = 0 ;
         return ;
       }
 
-      carrier_cycleCnt = ReadNumber_copy() ;
+      carrier_cycleCnt = ReadPulse() ;
 
       if (pattern_pulseCnt & 0x01) {
         // Periodo de reposo (no portadora) :
@@ -622,10 +961,16 @@ void IRCodeTask(void) {
                              ; // pues el módulo la deja en 0, que es el estado 
                              ; // activo del LED infrarojo.
         IR_PWM_PPS = 0b00000 ; // Se 'desconecta' la portadora de la salida.
+        #if IR_OUTPUTS > 1
+          LAT_IR2_PWM = 1 ; IR2_PWM_PPS = 0b00000 ;
+        #endif
       }
       else {
-        // Periodo activo de la portadora :
-        IR_PWM_PPS  = PPS_CCP1OUT ;
+        // Periodo activo de la portadora (en las salidas seleccionadas) :
+        IR_PWM_PPS  = ir_pwm_pps ;
+        #if IR_OUTPUTS > 1
+          IR2_PWM_PPS = ir2_pwm_pps ;
+        #endif
       }
     }
   }
@@ -639,6 +984,10 @@ void interrupt ServInt(void) {
 void IRCodeInit(void) {
   // Prepara la salida de control del LED Infrarrojo a su estado en reposo :
   LAT_IR_PWM = 1 ; ANSEL_IR_PWM = 0 ; TRIS_IR_PWM = 0 ;
+  #if IR_OUTPUTS > 1
+    LAT_IR2_PWM = 1 ; ANSEL_IR2_PWM = 0 ; TRIS_IR2_PWM = 0 ;
+    IR2_PWM_PPS = 0b00000 ;
+  #endif
 
   // Se prepara el módulo CCP1 para actuar en el modo PWM, y se mantiene
   // apagado...
@@ -652,16 +1001,38 @@ void IRCodeInit(void) {
   T2CONbits_OUTPS  = 0b0000 ; // Post-divisor 1:1
   
   T2CONbits.TMR2ON = 0 ;
+
+  // La recepción inicia en el primer banco, sin patrón para repetir :
+  irCodeRX = irCodeBank[0] ;
+  irCodeTX.check = REPEAT_NONE ;
+}
+
+
+/* Espera que termine la emisión en curso, mientras tanto se atienden las tareas de
+   control de tiempo y de supervisión del módulo ESP8266 :
+*/
+void IRCodeWait(void) {
+  while (!IRCodeHasEnded()) {
+    Tick_task() ;
+    ESP8266Watchdog_task() ;
+  }
 }
 
 
-/* Prepara para la generación del patrón de pulsos del LED infrarrojo,
-   la generación en sí se realiza en el servicio de interrupciones, 
-   aunque mantiene el control hasta que finalice.
+/* Decodifica la cabecera del patrón recibido (a partir de irCodeRX[pattern_idx.rd]) en 
+   irCodeTX y le cede su banco, la recepción continúa en el otro. Solo debe invocarse con
+   la emisión detenida (IRCodeWait()).
 */
-void IRCodeXmit(void) {
+void IRCodeLoad(void) {
+uint8_t options, opt, i, sum ;
+uint16_t value ;
+  // Verificación del patrón (suma de sus bytes, 7 bits) para su repetición :
+  for (sum = 0, i = 0 ; i < pattern_idx.wr ; i++) sum += irCodeRX[i] ;
+  irCodeTX.check = sum & 0x7F ;
+
   // Asigna los parámetros de generación del patrón :
   irCodeTX.num_pulses = ReadNumber() ;
+  options = (irCodeRX[0] == INFRARED_REMOTE_PROXY_PROTOCOL_2) ? (uint8_t)ReadNumber() : 0 ;
   irCodeTX.carrier.period = ReadNumber() ;
   
   // El ciclo de trabajo del LED es el complementario de la excitación a su 
@@ -669,9 +1040,56 @@ void IRCodeXmit(void) {
   // por el módulo PWM :
   irCodeTX.carrier.duty_cycle = irCodeTX.carrier.period - ReadNumber() ;
 
-  // Prepara para temporizar el (estado activo del) primer pulso :
+  // Opciones del patrón (se ignoran las desconocidas) :
+  irCodeTX.time_base = 1 ;
+  irCodeTX.outputs   = 0x01 ;
+  irCodeTX.delay     = 0 ;
+  for (opt = 0x01 ; opt < 0x80 ; opt <<= 1) {
+    if (options & opt) {
+      value = ReadNumber() ;
+      if ((opt == PATTERN_OPT_TIME_BASE) && (value > 0) && (value <= 0xFF)) {
+        irCodeTX.time_base = (uint8_t)value ;
+      }
+      else if (opt == PATTERN_OPT_OUTPUTS) {
+        irCodeTX.outputs = (uint8_t)value & IR_OUTPUTS_MASK ;
+      }
+      else if (opt == PATTERN_OPT_DELAY) {
+        irCodeTX.delay = value ;
+      }
+    }
+  }
+
+  // Intercambio de los bancos :
+  irCodeTX.bank   = irCodeRX ;
+  irCodeTX.pulses = pattern_idx.rd ;
+  irCodeRX = (irCodeRX == irCodeBank[0]) ? irCodeBank[1] : irCodeBank[0] ;
+}
+
+
+/* Inicia la generación del patrón de pulsos del LED infrarrojo (irCodeTX), 'times' veces
+   seguidas, la generación en sí se realiza en el servicio de interrupciones y termina por
+   sí sola (IRCodeHasEnded()), mientras tanto se puede recibir el siguiente mensaje.
+*/
+void IRCodeXmit(uint8_t times) {
+vlq_num_t num ;
+  // El patrón dirigido a salidas inexistentes no se emite :
+  if ((irCodeTX.outputs == 0) || (times == 0)) return ;
+  repeatCnt = times - 1 ;
+  ir_pwm_pps  = (irCodeTX.outputs & 0x01) ? PPS_CCP1OUT : 0b00000 ;
+  #if IR_OUTPUTS > 1
+    ir2_pwm_pps = (irCodeTX.outputs & 0x02) ? PPS_CCP1OUT : 0b00000 ;
+  #endif
+
+  // Prepara para temporizar el (estado activo del) primer pulso, tras la demora, que se
+  // consume : las repeticiones posteriores (REPEAT_ID) del patrón no la esperan :
+  time_baseCnt = irCodeTX.time_base ;
+  delayCnt = irCodeTX.delay ;
+  irCodeTX.delay = 0 ;
   pattern_pulseCnt = 0 ;
-  carrier_cycleCnt = ReadNumber() ;
+  irCodeTX.rd = irCodeTX.pulses ;
+  irCodeTX.rd += vlq_decode(&irCodeTX.bank[irCodeTX.rd], PATTERN_BANK_SIZE - irCodeTX.rd,
+                            VLQ_NUMBER_BYTES, &num) ;
+  carrier_cycleCnt = (uint8_t)num ;
 
   // Prepara los módulos CCP1 y TMR2 para generarla señal PWM con la frecuencia
   // de portadora y ciclo de trabajo solicitados  :
@@ -684,15 +1102,17 @@ void IRCodeXmit(void) {
   PIR1bits.TMR2IF  = 0 ;
   PIE1bits.TMR2IE  = 1 ;
 
-  // Activa la generación PWM, iniciando la generación del patrón ...
+  // Activa la generación PWM, iniciando la generación del patrón (o su demora, en cuyo
+  // caso IRCodeTask() conecta la portadora a las salidas al terminar) ...
   CCP1CONbits.CCP1MODE = 0b1111      ; // Modo PWM
   CCP1CONbits.CCP1EN   = 1           ;
-  LAT_IR_PWM           = 0           ;
-  IR_PWM_PPS           = PPS_CCP1OUT ;
+  if (delayCnt == 0) {
+    IR_PWM_PPS         = ir_pwm_pps  ;
+    #if IR_OUTPUTS > 1
+      IR2_PWM_PPS      = ir2_pwm_pps ;
+    #endif
+  }
   T2CONbits.TMR2ON     = 1           ;
-
-  // y espera a que termine :
-  while (!IRCodeHasEnded()) continue ;
 }
 
 
@@ -729,11 +1149,36 @@ void IRCodeXmit(void) {
 #define RCVE_TIMEOUT             ( 10e-3) /* seg. */
 #define CLEARANCE_TIME           (100e-3) /* seg. */
 
-/*
+/* Descripción de cada tipo de mensaje (registro de protocolos), ver "Despacho de 
+   Mensajes". Después de la identificación se reciben num_fields números de hasta 
+   field_len[] bytes, y si repeat_len no es 0, el primero de ellos es el número de pares
+   de números (de hasta repeat_len bytes) que les siguen. El mensaje completo no puede 
+   exceder max_len bytes, lo que se verifica conforme se recibe cada byte :
 */
-struct {
-  uint8_t rd, wr ;
-} pattern_idx ;
+#define MSG_MAX_FIELDS           (4)
+#define MSG_TABLE_SIZE           (16)
+#define MSG_TABLE_MASK           (MSG_TABLE_SIZE - 1)
+#define MSG_NONE                 (0xFF)   /* Entrada sin uso (ID imposible). */
+
+#define MSG_EMPTY                (0x01)   /* El primer número (tamaño) debe ser 0.   */
+#define MSG_OPTIONS              (0x02)   /* El segundo número (irCodeRX[2]) es la 
+                                             máscara de opciones, cada bit activo agrega
+                                             un número (2 bytes) a la cabecera.         */
+
+typedef struct {
+  uint8_t id ;
+  uint8_t max_len ;
+  uint8_t num_fields ;
+  uint8_t field_len[MSG_MAX_FIELDS] ;
+  uint8_t repeat_len ;
+  uint8_t flags ;
+  uint8_t rd ;                            // Índice de lectura inicial para handler().
+  void    (*handler)(void) ;
+} msg_desc_t ;
+
+extern const msg_desc_t msg_table[MSG_TABLE_SIZE] ;
+const msg_desc_t *rcve_msg ;
+uint8_t rcve_max_len ;
 
 /* NOTA : Debido a que durante el arranque del módulo ESP8266, la línea SCK, tiene
           una transición positiva, sería mejor utilizar el modo CPOL/CKP = 1, con
@@ -765,6 +1210,12 @@ volatile uint8_t dummy ;
   #endif
   TRIS_SDI = 1 ;  TRIS_SCK = 1 ;
 
+  #if LEARN_SUPPORT || TRACE_SUPPORT
+    // La salida SDO solo se utiliza para devolver el patrón aprendido y el registro de
+    // eventos :
+    SDO_PPS = PPS_SDO ; ANSEL_SDO = 0 ; TRIS_SDO = 0 ;
+  #endif
+
   // Inicialización del SPI en el modo esclavo/muestreo en el flanco positivo del
   // reloj :
   SSP1STATbits.SMP   = 0      ; // SMP = 0 en el modo esclavo.
@@ -830,13 +1281,15 @@ char Background_task(void) {
 bool RcveNumber(uint8_t len) {
 uint8_t i ;
   for (i = 0 ; i < len; i++) {
-    if (pattern_idx.wr >= sizeof(irCodeRX)) {
-      // La capacidad de almacenamiento fue desbordada :
+    if (pattern_idx.wr >= rcve_max_len) {
+      // La longitud máxima del mensaje o la capacidad de almacenamiento fue desbordada :
+      rcve_error = TRACE_ERR_OVERFLOW ;
       return false ;
     }
     
     while (!SSP1STATbits.BF) {
       if (Background_task()) {
+        rcve_error = TRACE_ERR_TIMEOUT ;
         return false ;
       } ;
     }
@@ -852,39 +1305,35 @@ uint8_t i ;
   }
 
   // El número de bytes del número supera la esperada :
+  rcve_error = TRACE_ERR_NUMBER ;
   return false ;
 }
 
 
-/* Devuelve el siguiente número almacenado.
+/* Devuelve el siguiente número almacenado (codec/vlq.c).
  * Solo es válido para números en empaquetados en 1 o 2 bytes.
 */
 uint16_t ReadNumber(void) {
-uint8_t b ;
-uint16_t num ;
-
-  b = irCodeRX[pattern_idx.rd++] ;
-  num = (uint16_t)b & 0x7F ;
-  if ((b & 0x080) != 0) {
-    b = irCodeRX[pattern_idx.rd++] ;
-    num += (((uint16_t)(b & 0x7F)) << 7)  ;
-  }
+vlq_num_t num ;
 
-  return num ;
+  pattern_idx.rd += vlq_decode(&irCodeRX[pattern_idx.rd], PATTERN_BANK_SIZE - pattern_idx.rd,
+                               VLQ_NUMBER_BYTES, &num) ;
+  return (uint16_t)num ;
 }
 
-/* Se incluye una copia de ReadNumber() para evitar que el compilador muestre la
- * advertencia que esta creando una copia, en vista que es invocada tanto por 
- * la tarea de fondo como por la de interrupciones.
+/* Devuelve la siguiente duración del patrón en emisión (irCodeTX), solo se invoca desde
+ * la interrupción de la portadora, por lo que no utiliza vlq_decode() para evitar que el
+ * compilador cree una copia de esta (también invocada por la tarea de fondo) y el costo
+ * de la invocación.
 */
-uint16_t ReadNumber_copy(void) {
+uint16_t ReadPulse(void) {
 uint8_t b ;
 uint16_t num ;
 
-  b = irCodeRX[pattern_idx.rd++] ;
+  b = irCodeTX.bank[irCodeTX.rd++] ;
   num = (uint16_t)b & 0x7F ;
   if ((b & 0x080) != 0) {
-    b = irCodeRX[pattern_idx.rd++] ;
+    b = irCodeTX.bank[irCodeTX.rd++] ;
     num += (((uint16_t)(b & 0x7F)) << 7)  ;
   }
 
@@ -901,9 +1350,11 @@ uint16_t num ;
    de control de tiempo (Tick_Task()) y de supervición del módulo (ESP8266Watchdog_task()).
 */
 bool PatternRcveTask(void) {
+const msg_desc_t *msg ;
 uint8_t i ;
   // Inicializa el índice de escritura :
   pattern_idx.wr = 0 ;
+  rcve_max_len = PATTERN_BANK_SIZE ;
   
   // Espera por la recepción del primer byte :
    while (!SSP1STATbits.BF) {
@@ -921,60 +1372,62 @@ uint8_t i ;
     return false ;
   }
 
-  // Verifica si se trata de los protocolos/identificadores de mensaje soportados :
-  if ((irCodeRX[0] == KEEPALIVE_ID) || (irCodeRX[0] == RESETREQ_ID)) {
-    // Espera por recibir el tamaño de la carga, aka. 0, para los mensajes de
-    // confirmación de la operatividad y /o solicitud de cebado del módulo ESP8266 :
-    if (!RcveNumber(sizeof(irCodeTX.num_pulses)) && (irCodeRX[1] != 0x00)) {
-      // La recepción fue incorrecta, incompleta o el tamaño esperado para la carga 
-      // no es la correcta :
-      return false ;
-    }
-
-    // La recepción del mensaje de confirmación de operatividad concluyo,
-    // con éxito :
-    return true ;
-  }
-
-  else if (irCodeRX[0] != INFRARED_REMOTE_PROXY_PROTOCOL) {
+  // Busca la descripción del mensaje, cada identificación ocupa la entrada dada por sus
+  // 4 bits de menor peso :
+  msg = &msg_table[irCodeRX[0] & MSG_TABLE_MASK] ;
+  if (msg->id != irCodeRX[0]) {
     // No se puede reconocer el protocolo :
+    rcve_error = TRACE_ERR_UNKNOWN ;
     return false ;
   }
+  rcve_max_len = msg->max_len ;
 
-  /* Se continua con la recepción del mensaje con el patrón de la señal
-     infraroja a trasmitir.
-  */
-  if (!RcveNumber(sizeof(irCodeTX.num_pulses))) {
-    // Se produjo un error en la comunicación :
-    return false ;
-  }
+  // Los mensajes sin carga (e.g. KEEPALIVE_ID) no se registran, para no saturar el 
+  // registro de eventos :
+  if (!(msg->flags & MSG_EMPTY)) Trace(TRACE_FRAME_START, irCodeRX[0]) ;
 
-  if (!RcveNumber(sizeof(irCodeTX.carrier.period))) {
-    // Se produjo un error en la comunicación :
-    return false ;
+  // Recibe los números de la cabecera del mensaje :
+  for (i = 0 ; i < msg->num_fields ; i++) {
+    if (!RcveNumber(msg->field_len[i])) {
+      // Se produjo un error en la comunicación o se excedió la longitud del mensaje :
+      return false ;
+    }
   }
 
-  if (!RcveNumber(sizeof(irCodeTX.carrier.duty_cycle))) {
-    // Se produjo un error en la comunicación :
+  if ((msg->flags & MSG_EMPTY) && (irCodeRX[1] != 0x00)) {
+    // El tamaño de la carga no es el esperado :
+    rcve_error = TRACE_ERR_PAYLOAD ;
     return false ;
   }
 
-  // Se reciben y verifican el formato de los periodos de los pulsos del patrón
-  // mientras se almacenan sin decodificarse :
-  for (i = 0 ; i < irCodeRX[1] ; i++) {
-    if ( RcveNumber(2) && // Tiempo de emisión de la portadora.
-         RcveNumber(2) ) { // Tiempo de reposo.
-      continue ;
+  // Recibe los números de las opciones activas :
+  if (msg->flags & MSG_OPTIONS) {
+    for (i = irCodeRX[2] ; i != 0 ; i >>= 1) {
+      if ((i & 0x01) && !RcveNumber(2)) {
+        return false ;
+      }
     }
+  }
 
-    // Se produjo un error en la comunicación y/o el la capacidad de almacenamiento fue
-    // desbordada :
-    return false ;
+  // Se reciben y verifican el formato de los pares de números (e.g. los periodos de los
+  // pulsos del patrón) mientras se almacenan sin decodificarse :
+  if (msg->repeat_len) {
+    for (i = 0 ; i < irCodeRX[1] ; i++) {
+      if ( RcveNumber(msg->repeat_len) && // Tiempo de emisión de la portadora.
+           RcveNumber(msg->repeat_len) ) { // Tiempo de reposo.
+        continue ;
+      }
+
+      // Se produjo un error en la comunicación y/o el la capacidad de almacenamiento fue
+      // desbordada :
+      return false ;
+    }
   }
 
-  // Se prepara el índice de lectura (nótese que se evita la lectura del
-  // primer byte, aquel que contiene el protocolo) :
-  pattern_idx.rd = 1 ;
+  // Se prepara el índice de lectura (nótese que se evita la lectura del primer byte,
+  // aquel que contiene el protocolo) :
+  pattern_idx.rd = msg->rd ;
+  rcve_msg = msg ;
 
   return true ;
 }
@@ -982,6 +1435,8 @@ uint8_t i ;
 
 void PatternRcveClearance(void) {
 volatile char dummy ;
+uint8_t discarded ;
+  discarded = 0 ;
   while (true) {
     TMR1 = (uint16_t)(-CLEARANCE_TIME * FTMR1) ;
     PIR1bits.TMR1IF = 0 ; PIR1bits.SSP1IF = 0 ;
@@ -992,15 +1447,378 @@ volatile char dummy ;
         // sincronización, por eso se reinicializa el interfaz SPI :
         SPI_Init() ;
 
+        Trace(TRACE_CLEARANCE, discarded) ;
         return  ;
       }
     }
 
     dummy = SSP1BUF ;
+    if (discarded != 0xFF) discarded++ ;
+  }
+}
+
+
+#if LEARN_SUPPORT || TRACE_SUPPORT
+/* Devuelve los 'len' bytes de 'data' por el SPI, precedidos por el byte 'sync', conforme
+   el módulo (maestro) los lee, hasta que pasen SPI_DUMP_TIMEOUT sin lecturas :
+*/
+#define SPI_DUMP_TIMEOUT         ( 2.0)   /* seg.     */
+
+void SPIDump(uint8_t sync, const uint8_t *data, uint8_t len) {
+uint8_t i ;
+int16_t last_tick ;
+volatile uint8_t dummy ;
+
+  // Descarta lo recibido hasta ahora (e.g. las lecturas de sondeo del módulo) :
+  dummy = SSP1BUF ;
+  SSP1CON1bits.SSPOV = 0 ;
+
+  SSP1BUF = sync ;
+  last_tick = tick_cnt ;
+  for (i = 0 ; i <= len ; ) {
+    if (SSP1STATbits.BF) {
+      dummy = SSP1BUF ;
+      if (i < len) SSP1BUF = data[i] ;
+      i++ ;
+      last_tick = tick_cnt ;
+    }
+
+    Background_task() ;
+    if ((tick_cnt - last_tick) > (int16_t)(SPI_DUMP_TIMEOUT/TICK_PERIOD)) {
+      break ;
+    }
+  }
+}
+#endif
+
+
+
+/** Aprendizaje de Patrones ************************************************************/
+
+/* En el modo de aprendizaje se captura la señal del receptor infrarrojo (demodulado, 
+   activo en bajo) y se devuelve el patrón correspondiente por el SPI, con el mismo
+   formato utilizado para su emisión, de manera que el módulo ESP8266 lo publique tal 
+   cual.
+
+   La solicitud (LEARN_ID) incluye el periodo y periodo activo de la portadora, pues el
+   receptor la elimina. Los tiempos de cada flanco se capturan con CCP2 en base a TMR1
+   (reconfigurado a 1 uS de resolución) y se cuantifican en periodos de la portadora 
+   conforme se reciben, almacenándose directamente en irCodeRX :
+
+     ciclos = (t[uS] * FOSC/1E6 + periodo/2) / periodo
+
+   La captura termina cuando no hay flancos durante LEARN_END_GAP, este tiempo se usa 
+   como la duración del último reposo, o si se excede el almacenamiento. Si no se recibe
+   ningún flanco durante LEARN_TIMEOUT, o si el periodo es menor que LEARN_MIN_PERIOD, se
+   devuelve un patrón sin pulsos. Cada duración se limita a LEARN_MAX_CYCLES, el máximo
+   número de 2 bytes que acepta la emisión.
+
+   Para devolver el patrón, se carga el byte de sincronía LEARN_SYNC en el SPI y luego
+   cada byte del patrón, conforme el módulo (maestro) los lee (SPIDump()).
+*/
+#if LEARN_SUPPORT
+
+#define LEARN_TIMEOUT            (10.0)   /* seg.     */
+#define LEARN_END_GAP            (60e-3)  /* seg.     */
+#define LEARN_SYNC               (0xA5)
+#define LEARN_TMR1_FREQ          (1e6)    /* Hz.      */
+#define LEARN_MIN_PERIOD         (4)      /* 1/FOSC   */
+#define LEARN_MAX_CYCLES         (0x3FFF)
+
+#define CCP2CONbits_MODE         CCP2CONbits.CCP2MODE
+#define CCP2CONbits_EN           CCP2CONbits.CCP2EN
+#define LEARN_CAPTURE_IF         PIR2bits.CCP2IF
+
+uint16_t learn_period ;
+
+/* Almacena el número en formato VLQ en irCodeRX, devuelve false si no hay espacio :
+*/
+bool WriteNumber(uint16_t num) {
+uint8_t n ;
+
+  n = vlq_encode(num, &irCodeRX[pattern_idx.wr], PATTERN_BANK_SIZE - pattern_idx.wr) ;
+  pattern_idx.wr += n ;
+  return (n != 0) ;
+}
+
+
+uint16_t LearnQuantize(uint16_t t_us) {
+uint32_t cycles ;
+
+  cycles = ((uint32_t)t_us * (uint8_t)(FOSC/1E6) + (learn_period >> 1)) / learn_period ;
+  return (cycles > LEARN_MAX_CYCLES) ? LEARN_MAX_CYCLES : (uint16_t)cycles ;
+}
+
+
+/* Captura el patrón y lo almacena codificado en irCodeRX, los parámetros de la portadora
+   son los recibidos en la solicitud (a partir de irCodeRX[pattern_idx.rd]) :
+*/
+void IRLearn(void) {
+uint16_t duty, last, now ;
+int16_t  start_tick ;
+uint8_t  num_pulses, n_idx ;
+bool     mark ;
+
+  learn_period = ReadNumber() ;
+  duty = ReadNumber() ;
+
+  // Cabecera del patrón, el número de pulsos se completa al terminar :
+  pattern_idx.wr = 0 ;
+  WriteNumber(INFRARED_REMOTE_PROXY_PROTOCOL) ;
+  n_idx = pattern_idx.wr ;
+  WriteNumber(0) ;
+  WriteNumber(learn_period) ;
+  WriteNumber(duty) ;
+  num_pulses = 0 ;
+
+  // Un periodo menor no es una portadora válida (y LearnQuantize() dividiría por cero) :
+  if (learn_period < LEARN_MIN_PERIOD) return ;
+
+  // Prepara el receptor y la captura de sus flancos (ambos) con CCP2 y TMR1 :
+  ANSEL_IR_RCVR = 0 ; TRIS_IR_RCVR = 1 ;
+  CCP2PPS = PPS_IR_RCVR ;
+  T1CONbits.TMR1ON  = 0    ;
+  T1CONbits.TMR1CS  = 0b00 ; // Reloj FCY (8 MHz) ...
+  T1CONbits.T1CKPS  = 0b11 ; // con el pre-divisor 1:8, aka. 1 uS.
+  TMR1 = 0 ;
+  T1CONbits.TMR1ON  = 1    ;
+  CCP2CONbits_MODE  = 0b0011 ; // Captura en cada flanco.
+  CCP2CONbits_EN    = 1 ;
+  LEARN_CAPTURE_IF  = 0 ;
+
+  // Espera el primer flanco (inicio del primer pulso) :
+  start_tick = tick_cnt ;
+  while (!LEARN_CAPTURE_IF) {
+    Background_task() ;
+    if ((tick_cnt - start_tick) > (int16_t)(LEARN_TIMEOUT/TICK_PERIOD)) {
+      CCP2CONbits_EN = 0 ;
+      return ;
+    }
+  }
+  LEARN_CAPTURE_IF = 0 ;
+  last = CCPR2 ;
+  mark = true ;
+
+  while (true) {
+    // Espera el siguiente flanco o el fin del patrón :
+    while (!LEARN_CAPTURE_IF) {
+      if ((uint16_t)(TMR1 - last) > (uint16_t)(LEARN_END_GAP * LEARN_TMR1_FREQ)) {
+        break ;
+      }
+    }
+
+    if (!LEARN_CAPTURE_IF) {
+      // Fin del patrón, el último reposo se completa con LEARN_END_GAP :
+      if (!mark && WriteNumber(LearnQuantize((uint16_t)(LEARN_END_GAP * LEARN_TMR1_FREQ)))) {
+        num_pulses++ ;
+      }
+      break ;
+    }
+
+    LEARN_CAPTURE_IF = 0 ;
+    now = CCPR2 ;
+    if (!WriteNumber(LearnQuantize(now - last))) {
+      break ;
+    }
+    if (!mark) num_pulses++ ;
+
+    last = now ;
+    mark = !mark ;
+  }
+
+  CCP2CONbits_EN = 0 ;
+
+  // Si el patrón terminó en la mitad de un pulso se descarta ese pulso incompleto :
+  irCodeRX[n_idx] = num_pulses ;
+}
+
+
+/* Devuelve el patrón almacenado en irCodeRX por el SPI, precedido por LEARN_SYNC :
+*/
+void IRLearnDump(void) {
+uint8_t i ;
+
+  // Longitud del patrón completo (se excluyen los bytes de un pulso incompleto) :
+  pattern_idx.rd = 1 ;
+  i = (uint8_t)ReadNumber() ;
+  ReadNumber() ; ReadNumber() ;
+  for (i = (uint8_t)(i << 1) ; i > 0 ; i--) ReadNumber() ;
+
+  SPIDump(LEARN_SYNC, irCodeRX, pattern_idx.rd) ;
+}
+
+#endif
+
+
+/** Despacho de Mensajes ***************************************************************/
+
+/* Cada mensaje se atiende con la función indicada en su descripción (msg_table[]), la
+   tabla es constante (en la memoria de programa) y está indexada por los 4 bits de menor
+   peso de la identificación, por lo que la búsqueda es directa. Para agregar un tipo de 
+   mensaje basta con ocupar una entrada libre con su descripción y su función.
+
+   Las identificaciones 0x7D (macro) y 0x7C (mensaje con vigencia) son interpretadas por
+   el módulo ESP8266 y nunca llegan al microcontrolador.
+*/
+
+/* El último patrón emitido permanece en su banco (irCodeTX.bank) hasta que se emite el
+   siguiente, pues los demás mensajes se reciben en el otro banco. REPEAT_ID lo emite el
+   número de veces indicado, si la verificación (irCodeTX.check, la suma de los bytes del
+   patrón, 7 bits) coincide :
+     [REPEAT_ID] [Veces] [Verificación]
+*/
+/* Devuelve true si el patrón recibido es urgente (PATTERN_OPT_PRIORITY no es 0) :
+*/
+bool PatternIsUrgent(void) {
+uint8_t idx, opt ;
+vlq_num_t value ;
+  if ((irCodeRX[0] != INFRARED_REMOTE_PROXY_PROTOCOL_2) ||
+      ((irCodeRX[2] & PATTERN_OPT_PRIORITY) == 0)) return false ;
+
+  // Omite el periodo, el periodo activo y las opciones previas a la prioridad (el patrón
+  // ya fue verificado en la recepción) :
+  idx = 3 ;
+  for (opt = 0 ; opt < 2 ; opt++) {
+    idx += vlq_decode(&irCodeRX[idx], PATTERN_BANK_SIZE - idx, VLQ_NUMBER_BYTES, &value) ;
+  }
+  for (opt = 0x01 ; opt < PATTERN_OPT_PRIORITY ; opt <<= 1) {
+    if (irCodeRX[2] & opt) {
+      idx += vlq_decode(&irCodeRX[idx], PATTERN_BANK_SIZE - idx, VLQ_NUMBER_BYTES, &value) ;
+    }
   }
+
+  vlq_decode(&irCodeRX[idx], PATTERN_BANK_SIZE - idx, VLQ_NUMBER_BYTES, &value) ;
+  return value != 0 ;
+}
+
+
+void PatternMsg_handler(void) {
+  // El patrón urgente cancela las repeticiones pendientes del anterior, cuya emisión 
+  // termina con la repetición en curso (un patrón truncado no es reconocido) :
+  if (PatternIsUrgent()) repeatCnt = 0 ;
+
+  // El patrón se recibió durante la emisión del anterior, espera que esta termine, le 
+  // cede su banco e inicia su emisión (sin esperar que termine) :
+  IRCodeWait() ;
+  IRCodeLoad() ;
+  IRCodeXmit(1) ;
+  
+  // Puesta a cero del Guardián del módulo ESP8266 :
+  ESP8266Watchdog_rearm(IR_INACTIVITY_TIMER) ;
+  
+  // Cancela el cebado largo, si es necesario :
+  reset_retries.cnt = 0 ;
+}
+
+
+void RepeatMsg_handler(void) {
+uint8_t n ;
+  n = irCodeRX[1] ;
+  if (irCodeRX[2] != irCodeTX.check) {
+    // El patrón solicitado no es el conservado (o no hay ninguno, REPEAT_NONE) :
+    return ;
+  }
+
+  // Trasmite el patrón las veces solicitadas, la interrupción encadena las repeticiones
+  // y la recepción continúa desde el inicio de la primera (un patrón urgente cancela las
+  // pendientes) :
+  IRCodeWait() ;
+  IRCodeXmit(n) ;
+
+  ESP8266Watchdog_rearm(IR_INACTIVITY_TIMER) ;
+  reset_retries.cnt = 0 ;
 }
 
 
+void KeepaliveMsg_handler(void) {
+  // Se recibó el mensaje de confirmación que comunicacíon esta operativa,
+  // se realiza la puesta a cero del guardián del módulo ESP8266 :
+  ESP8266Watchdog_rearm(KEEPALIVE_TIMER) ;
+  Trace(TRACE_KEEPALIVE, 1) ;
+}
+
+
+void ResetReqMsg_handler(void) {
+  // El módulo solicita su cebado (no pudo establecer comunicación con el router
+  // o el servidor MQQT), en consecuencia se ceba el sistema :
+  Trace(TRACE_RESTART, TRACE_RESTART_REQUEST) ;
+  ESP8266Watchdog_reset() ;
+}
+
+
+#if LEARN_SUPPORT
+void LearnMsg_handler(void) {
+  // Captura el patrón del receptor infrarrojo (terminada la emisión en curso, que usa 
+  // el mismo medio) y lo devuelve al módulo :
+  IRCodeWait() ;
+  IRLearn() ;
+  IRLearnDump() ;
+
+  // Restablece TMR1 como guardián de la recepción y el interfaz SPI :
+  PatternRcveInit() ;
+}
+#endif
+
+
+#if TRACE_SUPPORT
+void TraceMsg_handler(void) {
+  // Devuelve el registro de eventos al módulo :
+  SPIDump(TRACE_SYNC, &trace.size, sizeof(trace) - 1) ;
+  SPI_Init() ;
+}
+#endif
+
+
+const msg_desc_t msg_table[MSG_TABLE_SIZE] = {
+  /* 0x00 */  { MSG_NONE } ,
+
+  /* 0x01 : [ID] [Número de pulsos] [Periodo] [Periodo activo] ([Alto] [Bajo]) ... */
+  { INFRARED_REMOTE_PROXY_PROTOCOL, PATTERN_BANK_SIZE, 3,
+    { sizeof(irCodeTX.num_pulses), sizeof(irCodeTX.carrier.period),
+      sizeof(irCodeTX.carrier.duty_cycle) },
+    2, 0, 1, PatternMsg_handler } ,
+
+  /* 0x02 : [ID] [Número de pulsos] [Opciones] [Periodo] [Periodo activo] [Opción] ... 
+             ([Alto] [Bajo]) ... */
+  { INFRARED_REMOTE_PROXY_PROTOCOL_2, PATTERN_BANK_SIZE, 4,
+    { sizeof(irCodeTX.num_pulses), 1, sizeof(irCodeTX.carrier.period),
+      sizeof(irCodeTX.carrier.duty_cycle) },
+    2, MSG_OPTIONS, 1, PatternMsg_handler } ,
+
+  /* 0x03 */  { MSG_NONE } ,
+  /* 0x04 */  { MSG_NONE } ,
+  /* 0x05 */  { MSG_NONE } ,
+  /* 0x06 */  { MSG_NONE } ,
+  /* 0x07 */  { MSG_NONE } ,
+  /* 0x78 */  { MSG_NONE } ,
+
+  /* 0x79 : [ID] [0] */
+#if TRACE_SUPPORT
+  { TRACE_ID, 2, 1, { 1 }, 0, MSG_EMPTY, 2, TraceMsg_handler } ,
+#else
+  { MSG_NONE } ,
+#endif
+
+  /* 0x7A : [ID] [Veces] [Verificación] */
+  { REPEAT_ID, 3, 2, { 1, 1 }, 0, 0, 1, RepeatMsg_handler } ,
+
+  /* 0x7B : [ID] [Tamaño] [Periodo] [Periodo activo] */
+#if LEARN_SUPPORT
+  { LEARN_ID, 6, 3, { 1, 2, 2 }, 0, 0, 2, LearnMsg_handler } ,
+#else
+  { MSG_NONE } ,
+#endif
+
+  /* 0x7C */  { MSG_NONE } ,
+  /* 0x7D */  { MSG_NONE } ,
+
+  /* 0x7E : [ID] [0] */
+  { RESETREQ_ID, 2, 1, { 1 }, 0, MSG_EMPTY, 2, ResetReqMsg_handler } ,
+
+  /* 0x7F : [ID] [0] */
+  { KEEPALIVE_ID, 2, 1, { 1 }, 0, MSG_EMPTY, 2, KeepaliveMsg_handler } ,
+} ;
+
 
 /** Programa Principal *****************************************************************/
 
@@ -1015,6 +1833,8 @@ enum {
   PROXY_STAGE
 } stage ;
 uint8_t n, b ;
+bool    rcve_ok ;
+uint8_t traced_stage ;
 
   /* Inicialización del sistema interno del microcontrolador :
   */
@@ -1053,7 +1873,6 @@ uint8_t n, b ;
   if ((reset_retries.validation_key == RETRIES_VALID_KEY) 
                                          && (reset_retries.cnt > MAX_RETRIES_REQUEST)) {
     stage = STARTUP_EXTENDED_DELAY_STAGE ;
-    stage = PS_STARTUP_DELAY_STAGE ;
   }
   else {
     stage = PS_STARTUP_DELAY_STAGE ;
@@ -1066,22 +1885,39 @@ uint8_t n, b ;
     reset_retries.cnt = 0 ;
   }
 
+  // Registra el arranque en el registro de eventos :
+  Trace_init() ;
+  traced_stage = 0xFF ;
+
   // Configura el pre-regulador :
   SDPWM_init() ;
 
   // Arranca la base de tiempos :
   Tick_init() ;
 
+  // y la supervisión de la tensión de alimentación :
+  VddMonitor_init() ;
+  VddMonitor_rearm() ;
+
   // Finalmente, activa las interrupciones y arranca el sistema :
   INTCONbits.GIE  = 1 ; INTCONbits.PEIE = 1 ;
 
   // e inicia las tareas ...
   while (1) {
+    if (stage != traced_stage) {
+      traced_stage = stage ;
+      Trace(TRACE_STAGE, stage) ;
+    }
+
     switch (stage) {
       case STARTUP_EXTENDED_DELAY_STAGE :
         if (tick_cnt > (int16_t)(EXTENDED_DELAY_TIME/TICK_PERIOD)) {
-          stage = PS_STARTUP_STAGE ;
+          // Concluido el cebado extendido se concede una nueva serie de reintentos :
+          reset_retries.cnt = 0 ;
+
+          stage = PS_STARTUP_DELAY_STAGE ;
           tick_cnt = 0 ;
+          VddMonitor_rearm() ;
         }
 
         // Durante esta etapa solo la tarea de control de tiempo esta activa :
@@ -1089,8 +1925,10 @@ uint8_t n, b ;
       break ;
       
       case PS_STARTUP_DELAY_STAGE :
-        //if (tick_cnt > (uint16_t)(NORMAL_DELAY_TIME/TICK_PERIOD)) stage = STARTUP_STAGE ;
-        if (tick_cnt > 10) {
+        // Espera que la tensión suministrada a través de R1 se estabilice antes de 
+        // arrancar el pre-regulador :
+        if (VddMonitor_isStable() 
+                       || (tick_cnt > (int16_t)(VDD_STARTUP_TIMEOUT/TICK_PERIOD))) {
           stage = PS_STARTUP_STAGE ;
           tick_cnt = 0 ;
         }
@@ -1105,13 +1943,18 @@ uint8_t n, b ;
 
         stage = EPS_STARTUP_DELAY_STAGE ;
         tick_cnt = 0 ;
+        VddMonitor_rearm() ;
 
         Tick_task() ;
       break ;
 
       case EPS_STARTUP_DELAY_STAGE :
-        //if (tick_cnt > (uint16_t)(NORMAL_DELAY_TIME/TICK_PERIOD)) stage = STARTUP_STAGE ;
-        if (tick_cnt > 10) {
+        // Espera que la salida se mantenga en regulación con el pre-regulador operando,
+        // antes de permitir el arranque del módulo ESP8266 (que incrementa la carga) :
+        if (VddMonitor_isStable() 
+                       || (tick_cnt > (int16_t)(VDD_STARTUP_TIMEOUT/TICK_PERIOD))) {
+          VddMonitor_stop() ;
+
           stage = EPS_STARTUP_STAGE ;
           tick_cnt = 0 ;
         }
@@ -1137,41 +1980,24 @@ uint8_t n, b ;
 
       case PROXY_STAGE :
         // Se recibe el patrón :
-        if (PatternRcveTask()) {
+        rcve_ok = PatternRcveTask() ;
+
+        if (rcve_ok) {
           // Se recibió un mensaje y se procesa de acuerdo a su tipo :
-          switch (irCodeRX[0]) {
-            case INFRARED_REMOTE_PROXY_PROTOCOL :
-              // Trasmite la señal respectiva al código recibido :
-              IRCodeXmit() ;
-              
-              // Puesta a cero del Guardián del módulo ESP8266 :
-              ESP8266Watchdog_rearm(IR_INACTIVITY_TIMER) ;
-              
-              // Cancela el cebado largo, si es necesario :
-              reset_retries.cnt = 0 ;
-            break ;
-
-            case KEEPALIVE_ID :
-              // Se recibó el mensaje de confirmación que comunicacíon esta operativa,
-              // se realiza la puesta a cero del guardián del módulo ESP8266 :
-              ESP8266Watchdog_rearm(KEEPALIVE_TIMER) ;
-            break ;
-
-            case RESETREQ_ID :
-              // El módulo solicita su cebado (no pudo establecer comunicación con el router
-              // o el servidor MQQT), en consecuencia se ceba el sistema :
-              ESP8266Watchdog_reset() ;
-          }
+          rcve_msg->handler() ;
+          if (!(rcve_msg->flags & MSG_EMPTY)) Trace(TRACE_FRAME_END, pattern_idx.wr) ;
 
           // Se continua con la recepción del siguiente mensaje :
         }
         else {
           // Se recibio un mensaje con un formato incorrecto :
+          Trace(TRACE_PARSE_ERROR, rcve_error) ;
           PatternRcveClearance() ;
         }
       break ;
 
       default :
+        Trace(TRACE_RESTART, TRACE_RESTART_STAGE) ;
         asm("RESET") ;
     }
   }
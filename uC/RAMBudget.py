@@ -0,0 +1,125 @@
+#!python
+# -*- coding: UTF-8 -*-
+
+u"""
+Reporte del uso de la memoria de datos (RAM) a partir del archivo de mapa (.map) generado
+por XC8, se ejecuta como paso posterior a la compilación del proyecto IRProxy.X :
+
+  python ../RAMBudget.py ${ImagePath} || exit 0
+
+Muestra el resumen de la memoria de datos (Memory Summary), la ocupación de cada sección
+de datos (psect) y la de los buffers de los patrones (irCodeBank, irCodeTX, ...), y
+advierte si la memoria libre es menor que la reserva '--reserve' (bytes). Solo informa :
+el formato del mapa se verificó con un mapa escrito a mano (XC8 v1), no con el de cada
+versión de XC8, por lo que ni un mapa que no reconoce ni el presupuesto excedido hacen
+fallar la compilación, salvo con '--strict'. Es compatible con Python 2.7 y 3.
+"""
+
+import io
+import os
+import re
+import sys
+import argparse
+
+# Símbolos de interés (los de C llevan el prefijo '_' en el mapa) :
+SYMBOLS = ['_irCodeBank', '_irCodeTX', '_irCodeRX', '_pattern_idx', '_trace']
+
+# Espacio de la memoria de datos en la tabla de secciones (Space) :
+DATA_SPACE = 1
+
+SUMMARY_RE = re.compile(r'Data space\s+used\s+([0-9A-Fa-f]+)h\s+\(\s*(\d+)\)\s+of\s+'
+                        r'([0-9A-Fa-f]+)h\s+bytes')
+# La primera sección de cada módulo lleva su nombre (e.g. 'startup.obj') en la misma línea :
+PSECT_RE = re.compile(r'^\s*(?:\S+\s+)??(\w+)\s+([0-9A-Fa-f]+)\s+([0-9A-Fa-f]+)\s+([0-9A-Fa-f]+)\s+'
+                      r'([0-9A-Fa-f]+)\s+(\d+)(\s+\d+)?\s*$')
+SYMBOL_RE = re.compile(r'(_\w+)\s+(\w+)\s+([0-9A-Fa-f]{4})\b')
+
+
+def map_file(path) :
+  u"""
+  Devuelve el archivo de mapa que corresponde a la imagen 'path' (.hex, .elf o .map).
+  """
+  return os.path.splitext(path)[0] + '.map'
+
+
+def parse(text) :
+  u"""
+  Devuelve (usados, total, {sección : (dirección, longitud)}, {símbolo : (sección,
+  dirección)}) de la memoria de datos descrita en el mapa 'text'.
+  """
+  summary = SUMMARY_RE.search(text)
+  if summary is None :
+    raise ValueError('El mapa no contiene el resumen de la memoria de datos.')
+  used, total = int(summary.group(2)), int(summary.group(3), 16)
+
+  psects = {}
+  for line in text.splitlines() :
+    m = PSECT_RE.match(line)
+    if m and int(m.group(6)) == DATA_SPACE :
+      link, length = int(m.group(2), 16), int(m.group(4), 16)
+      if m.group(1) in psects :
+        # La misma sección en varios módulos, se reporta su extensión total :
+        start, size = psects[m.group(1)]
+        end = max(start + size, link + length)
+        start = min(start, link)
+        psects[m.group(1)] = (start, end - start)
+      elif length :
+        psects[m.group(1)] = (link, length)
+
+  symbols = {}
+  table = text.find('Symbol Table')
+  for m in SYMBOL_RE.finditer(text[table:] if table >= 0 else '') :
+    if m.group(2) in psects :
+      symbols[m.group(1)] = (m.group(2), int(m.group(3), 16))
+
+  return used, total, psects, symbols
+
+
+def symbol_size(name, psects, symbols) :
+  u"""
+  Devuelve el tamaño estimado del símbolo 'name' : la distancia al siguiente símbolo de su
+  sección, o al fin de esta.
+  """
+  psect, addr = symbols[name]
+  start, size = psects[psect]
+  following = [a for p, a in symbols.values() if p == psect and a > addr]
+  return (min(following) if following else start + size) - addr
+
+
+def report(path, reserve) :
+  u"""
+  Imprime el uso de la memoria de datos del mapa de la imagen 'path', devuelve False si no
+  se pudo leer o si quedan menos de 'reserve' bytes libres.
+  """
+  try :
+    with io.open(map_file(path), encoding='latin-1') as f :
+      used, total, psects, symbols = parse(f.read())
+  except (IOError, OSError, ValueError) as e :
+    print('No se pudo leer el mapa de %s : %s' % (path, e))
+    return False
+
+  print('Memoria de datos : %d de %d bytes (%.1f%%), libres %d' %
+        (used, total, 100.0 * used / total, total - used))
+  for name, (start, size) in sorted(psects.items(), key=lambda p : p[1]) :
+    print('  %-16s 0x%03X %4d' % (name, start, size))
+  for name in SYMBOLS :
+    if name in symbols :
+      print('  %-16s %-12s %4d' % (name[1:], symbols[name][0],
+                                   symbol_size(name, psects, symbols)))
+
+  if total - used < reserve :
+    print('Advertencia : se excede el presupuesto, se requieren %d bytes libres.' % reserve)
+    return False
+  return True
+
+
+if __name__ == '__main__' :
+  parser = argparse.ArgumentParser(description='Uso de la memoria de datos (mapa de XC8).')
+  parser.add_argument('image', help='Imagen (.hex, .elf) o mapa (.map) del proyecto.')
+  parser.add_argument('--reserve', type=int, default=8,
+                      help='Bytes libres mínimos (margen del presupuesto).')
+  parser.add_argument('--strict', action='store_true',
+                      help='Termina con error si se excede el presupuesto o no se lee el mapa.')
+  args = parser.parse_args()
+
+  sys.exit(0 if report(args.image, args.reserve) or not args.strict else 1)